@@ -0,0 +1,418 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* micro and macro benchmarks of the hot paths, against local_hdfs.cc so they
+ * run anywhere. prints one JSON document to stdout:
+ *
+ *   {"suite": "awesome_hdfs", "scale": 1, "results": [
+ *     {"name": "remove_double_slash", "kind": "micro", "ops": 2097152,
+ *      "seconds": 0.21, "ns_per_op": 100.1, "bytes": 0, "mb_per_s": 0}, ...]}
+ *
+ * a micro benchmark is run until a round takes BENCH_ROUND_MS, the fastest of
+ * BENCH_ROUNDS rounds is kept. a macro one is a whole put/getmerge/read, run
+ * BENCH_ROUNDS times. usage: awesome_hdfs_bench [scale], scale multiplies the
+ * size of the macro data sets (64MB at 1). */
+
+#include "hadoop_fs.h"
+#include "hdfs_stream.h"
+#include "metrics.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BENCH_ROUNDS   3
+#define BENCH_ROUND_MS 200
+#define BENCH_HOST     "localhost"
+#define BENCH_PORT     8020
+#define BENCH_MB       (1024*1024)
+
+void local_hdfs_root(const char* root);
+size_t local_hdfs_largest_read();
+
+struct bench_result {
+	std::string name;
+	const char* kind;
+	uint64_t ops;
+	uint64_t bytes;
+	uint64_t ns;
+};
+
+/* runs <n> operations, returns the bytes they went through, 0 if that means nothing */
+typedef uint64_t (*bench_fn)(void* ctx, uint64_t n);
+
+static std::vector<bench_result> results;
+static std::string root;
+static int scale = 1;
+static size_t largest_read = 0;  /* of hdfsRead() during the lines benchmark */
+
+static void micro(const char* name, bench_fn fn, void* ctx) {
+	uint64_t n = 1;
+	uint64_t took = 0;
+	while (true) {
+		uint64_t start = metric_now();
+		fn(ctx, n);
+		took = metric_now() - start;
+		if (took >= BENCH_ROUND_MS * 1000000ULL / 4) {
+			break;
+		}
+		n *= 2;
+	}
+	n = n * (BENCH_ROUND_MS * 1000000ULL) / (took + 1) + 1;
+
+	bench_result r;
+	r.name = name;
+	r.kind = "micro";
+	r.ops = n;
+	r.bytes = 0;
+	r.ns = 0;
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		uint64_t start = metric_now();
+		uint64_t bytes = fn(ctx, n);
+		uint64_t ns = metric_now() - start;
+		if (r.ns == 0 or ns < r.ns) {
+			r.ns = ns;
+			r.bytes = bytes;
+		}
+	}
+	results.push_back(r);
+}
+
+static void macro(const char* name, bench_fn fn, void* ctx, uint64_t ops) {
+	bench_result r;
+	r.name = name;
+	r.kind = "macro";
+	r.ops = ops;
+	r.bytes = 0;
+	r.ns = 0;
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		uint64_t start = metric_now();
+		uint64_t bytes = fn(ctx, 1);
+		uint64_t ns = metric_now() - start;
+		if (r.ns == 0 or ns < r.ns) {
+			r.ns = ns;
+			r.bytes = bytes;
+		}
+	}
+	results.push_back(r);
+}
+
+/* check() is compiled out without DEBUG, a failed step must not report a time */
+static void must(bool ok, const char* what) {
+	if (not ok) {
+		fprintf(stderr, "%s:%s\n", what, strerror(errno));
+		exit(1);
+	}
+}
+
+static std::string under_root(const std::string &path) {
+	return root + path;
+}
+
+/* <size> bytes of <line_size> long lines */
+static void make_file(const std::string &path, size_t size, size_t line_size) {
+	FILE* f = fopen(path.c_str(), "w");
+	must(f != NULL, path.c_str());
+	std::string line(line_size - 1, 'x');
+	line += '\n';
+	for (size_t i = 0; i + line.size() <= size; i += line.size()) {
+		line[0] = 'a' + i % 26;
+		fwrite(line.data(), 1, line.size(), f);
+	}
+	fclose(f);
+}
+
+static void make_dir(const std::string &path) {
+	if (mkdir(path.c_str(), 0755) != 0 and errno != EEXIST) {
+		fprintf(stderr, "mkdir %s:%s\n", path.c_str(), strerror(errno));
+		exit(1);
+	}
+}
+
+static int remove_one(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+	return remove(path);
+}
+
+/* ---- micro ---- */
+
+struct slash_ctx {
+	std::vector<std::string> paths;
+};
+
+static uint64_t bench_remove_double_slash(void* ctx, uint64_t n) {
+	slash_ctx* c = (slash_ctx*)ctx;
+	uint64_t bytes = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		bytes += remove_double_slash(c->paths[i % c->paths.size()]).size();
+	}
+	return bytes;
+}
+
+struct line_ctx {
+	HDFS_STREAM* stream;
+};
+
+static uint64_t bench_getline(void* ctx, uint64_t n) {
+	HDFS_STREAM* s = ((line_ctx*)ctx)->stream;
+	uint64_t bytes = 0;
+	for (uint64_t i = 0; i < n; i++) {
+		ssize_t len = 0;
+		char* line = s->getline(&len);
+		free(line);
+		if (len == 0) {
+			s->seek(0);
+		}
+		bytes += len > 0 ? len : 0;
+	}
+	return bytes;
+}
+
+static uint64_t bench_readline(void* ctx, uint64_t n) {
+	HDFS_STREAM* s = ((line_ctx*)ctx)->stream;
+	uint64_t bytes = 0;
+	s->lock();
+	for (uint64_t i = 0; i < n; i++) {
+		const char* line = NULL;
+		ssize_t len = s->readline(&line);
+		if (len == 0) {
+			s->unlock();
+			s->seek(0);
+			s->lock();
+		}
+		bytes += len > 0 ? len : 0;
+	}
+	s->unlock();
+	return bytes;
+}
+
+struct glob_ctx {
+	HDFS_FILE* fs;
+	const char* pattern;
+	size_t matches;
+};
+
+static void count_match(const char* path, void* ctx) {
+	((glob_ctx*)ctx)->matches++;
+}
+
+static uint64_t bench_glob(void* ctx, uint64_t n) {
+	glob_ctx* c = (glob_ctx*)ctx;
+	for (uint64_t i = 0; i < n; i++) {
+		c->matches = 0;
+		c->fs->glob(c->pattern, count_match, c, 0);
+	}
+	return 0;
+}
+
+static uint64_t bench_metric_scope(void* ctx, uint64_t n) {
+	for (uint64_t i = 0; i < n; i++) {
+		METRIC_SCOPE m(METRIC_EXIST);
+	}
+	return 0;
+}
+
+/* ---- macro ---- */
+
+struct macro_ctx {
+	HDFS_FILE* fs;
+	std::string local;
+	std::string remote;
+	size_t size;
+};
+
+static uint64_t bench_put(void* ctx, uint64_t n) {
+	macro_ctx* c = (macro_ctx*)ctx;
+	if (c->fs->exist(c->remote.c_str())) {
+		c->fs->rm(c->remote.c_str());
+	}
+	must(c->fs->put(c->local.c_str(), c->remote.c_str()) == 0, "put");
+	return c->size;
+}
+
+static uint64_t bench_getmerge(void* ctx, uint64_t n) {
+	macro_ctx* c = (macro_ctx*)ctx;
+	unlink(c->local.c_str());
+	must(c->fs->getmerge(c->remote.c_str(), c->local.c_str()) == 0, "getmerge");
+	return c->size;
+}
+
+static uint64_t bench_read(void* ctx, uint64_t n) {
+	macro_ctx* c = (macro_ctx*)ctx;
+	must(c->fs->open(c->remote.c_str(), "r") == 0, "open");
+	std::vector<char> buf(BENCH_MB);
+	uint64_t bytes = 0;
+	ssize_t got;
+	while ((got = c->fs->read_bytes(&buf[0], buf.size())) > 0) {
+		bytes += got;
+	}
+	c->fs->close();
+	return bytes;
+}
+
+static uint64_t bench_lines(void* ctx, uint64_t n) {
+	macro_ctx* c = (macro_ctx*)ctx;
+	must(c->fs->open(c->remote.c_str(), "r") == 0, "open");
+	uint64_t bytes = 0;
+	while (true) {
+		ssize_t len = 0;
+		char* line = c->fs->getline(&len);
+		free(line);
+		if (len <= 0) {
+			break;
+		}
+		bytes += len;
+	}
+	c->fs->close();
+	return bytes;
+}
+
+static void print_results() {
+	printf("{\"suite\": \"awesome_hdfs\", \"libhdfs\": \"local_hdfs\", \"scale\": %d, \"time\": %ld, "
+			"\"largest_read\": %zu, \"results\": [\n",
+			scale, (long)time(NULL), largest_read);
+	for (size_t i = 0; i < results.size(); i++) {
+		const bench_result &r = results[i];
+		double seconds = r.ns / 1e9;
+		printf("  {\"name\": \"%s\", \"kind\": \"%s\", \"ops\": %llu, \"seconds\": %.6f, \"ns_per_op\": %.1f, "
+				"\"bytes\": %llu, \"mb_per_s\": %.1f}%s\n",
+				r.name.c_str(), r.kind, (unsigned long long)r.ops, seconds, (double)r.ns / r.ops,
+				(unsigned long long)r.bytes, seconds > 0 ? r.bytes / seconds / BENCH_MB : 0.0,
+				(i + 1 < results.size()) ? "," : "");
+	}
+	printf("]}\n");
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+int main(int argc, char** argv) {
+	if (argc > 1) {
+		scale = atoi(argv[1]);
+		if (scale <= 0) {
+			fprintf(stderr, "usage: %s [scale]\n", argv[0]);
+			return 2;
+		}
+	}
+	char dir[] = "/tmp/awesome_hdfs_bench.XXXXXX";
+	if (mkdtemp(dir) == NULL) {
+		fprintf(stderr, "mkdtemp:%s\n", strerror(errno));
+		return 1;
+	}
+	root = dir;
+	local_hdfs_root(dir);
+	/* no JVM here, the jar scan has nothing to find */
+	make_dir(root + "/share");
+	make_dir(root + "/share/hadoop");
+	setenv("HADOOP_HOME", dir, 0);
+	setenv("AWESOME_HDFS_CLASSPATH_CACHE", "", 1);
+
+	HDFS_FILE fs(BENCH_HOST, BENCH_PORT);
+
+	slash_ctx slash;
+	for (int i = 0; i < 1024; i++) {
+		char path[256];
+		snprintf(path, sizeof(path), "hdfs://%s:%d//user/bench//logs/2015-%02d-%02d//part-%05d",
+				BENCH_HOST, BENCH_PORT, i % 12 + 1, i % 28 + 1, i);
+		slash.paths.push_back(path);
+	}
+	micro("remove_double_slash", bench_remove_double_slash, &slash);
+
+	make_dir(under_root("/micro"));
+	make_file(under_root("/micro/lines"), 8 * BENCH_MB, 100);
+	HDFS_STREAM* stream = fs.open_stream("/micro/lines", "r");
+	must(stream != NULL, "open_stream");
+	line_ctx lines = {stream};
+	micro("stream_getline", bench_getline, &lines);
+	micro("stream_readline", bench_readline, &lines);
+	delete stream;
+
+	/* 32 directories of 256 files, listed once and then served by META_CACHE */
+	make_dir(under_root("/glob"));
+	for (int d = 0; d < 32; d++) {
+		char path[256];
+		snprintf(path, sizeof(path), "/glob/d%02d", d);
+		make_dir(under_root(path));
+		for (int f = 0; f < 256; f++) {
+			snprintf(path, sizeof(path), "/glob/d%02d/part-%05d", d, f);
+			close(creat(under_root(path).c_str(), 0644));
+		}
+	}
+	const char* patterns[][2] = {
+		{"glob_star", "/glob/*/part-0001?"},
+		{"glob_range", "/glob/d0[0-9]/part-000[0-4]*"},
+		{"glob_braces", "/glob/{d01,d17,d30}/part-{00001,00100,00200}"},
+	};
+	for (size_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		glob_ctx g = {&fs, patterns[i][1], 0};
+		micro(patterns[i][0], bench_glob, &g);
+	}
+	micro("metric_scope", bench_metric_scope, NULL);
+
+	size_t size = (size_t)scale * 64 * BENCH_MB;
+	make_dir(under_root("/macro"));
+	make_dir(root + "/local");
+	make_file(root + "/local/big", size, 4096);
+	macro_ctx put = {&fs, root + "/local/big", "/macro/put", size};
+	macro("put", bench_put, &put, 1);
+
+	make_dir(under_root("/macro/parts"));
+	for (int i = 0; i < 16; i++) {
+		char path[256];
+		snprintf(path, sizeof(path), "/macro/parts/part-%05d", i);
+		make_file(under_root(path), size / 16, 100);
+	}
+	macro_ctx merge = {&fs, root + "/local/merged", "/macro/parts", size / 16 / 100 * 100 * 16};
+	macro("getmerge", bench_getmerge, &merge, 1);
+
+	make_file(under_root("/macro/read"), size, 100);
+	macro_ctx read = {&fs, "", "/macro/read", size};
+	macro("read", bench_read, &read, 1);
+	macro_ctx line_read = {&fs, "", "/macro/read", size};
+	local_hdfs_largest_read();
+	macro("lines", bench_lines, &line_read, size / 100);
+	/* small sequential reads must grow the refills to the stream's buffer size */
+	largest_read = local_hdfs_largest_read();
+	if (largest_read < DEFAULT_STREAM_BUFFER_SIZE) {
+		fprintf(stderr, "sequential refills stopped at %zu bytes\n", largest_read);
+		return 1;
+	}
+
+	print_results();
+	nftw(dir, remove_one, 64, FTW_DEPTH | FTW_PHYS);
+	return 0;
+}
@@ -0,0 +1,451 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* the part of libhdfs the module uses, on top of a local directory, so the
+ * benchmarks run without a JVM or a cluster. it costs what the local file
+ * system costs: the numbers measure the module, not hdfs. */
+
+#include "hdfs.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LOCAL_BLOCK_SIZE (128*1024*1024)
+
+struct hdfs_internal {
+	std::string authority;  /* "hdfs://host:port", what listed names start with */
+};
+
+struct hdfsFile_internal {
+	int fd;
+	int flags;
+	uint64_t nread;
+};
+
+struct hadoopRzOptions {
+	int skip_checksum;
+};
+
+struct hadoopRzBuffer {
+	void* data;
+	int32_t length;
+};
+
+static std::string local_root = "/tmp";
+static tSize largest_read = 0;
+
+/* every hdfs path is taken under <root> */
+void local_hdfs_root(const char* root) {
+	local_root = root;
+}
+
+/* the largest size asked of hdfsRead() since the last call, the readahead
+ * thread reads too */
+size_t local_hdfs_largest_read() {
+	return __sync_lock_test_and_set(&largest_read, 0);
+}
+
+/* "hdfs://host:port/a/b" and "/a/b" are both <root>/a/b */
+static std::string local_path(const char* path) {
+	std::string p = path;
+	size_t schema = p.find("://");
+	if (schema != std::string::npos) {
+		size_t start = p.find('/', schema + 3);
+		p = (start == std::string::npos) ? "/" : p.substr(start);
+	}
+	while (p.size() > 1 and p[p.size()-1] == '/') {
+		p.erase(p.size() - 1);
+	}
+	if (p.empty() or p[0] != '/') {
+		p = "/" + p;
+	}
+	return local_root + p;
+}
+
+hdfsFS hdfsConnectNewInstance(const char* host, tPort port) {
+	hdfsFS fs = new hdfs_internal;
+	char authority[1024];
+	snprintf(authority, sizeof(authority), "hdfs://%s:%d", host, (int)port);
+	fs->authority = authority;
+	return fs;
+}
+
+hdfsFS hdfsConnect(const char* host, tPort port) {
+	return hdfsConnectNewInstance(host, port);
+}
+
+int hdfsDisconnect(hdfsFS fs) {
+	delete fs;
+	return 0;
+}
+
+int hdfsExists(hdfsFS fs, const char* path) {
+	struct stat st;
+	return stat(local_path(path).c_str(), &st) == 0 ? 0 : -1;
+}
+
+static void fill_info(hdfsFS fs, hdfsFileInfo* info, const std::string &path, const struct stat &st) {
+	bool dir = S_ISDIR(st.st_mode);
+	info->mKind = dir ? kObjectKindDirectory : kObjectKindFile;
+	info->mName = strdup((fs->authority + path.substr(local_root.size())).c_str());
+	info->mLastMod = st.st_mtime;
+	info->mSize = dir ? 0 : st.st_size;
+	info->mReplication = dir ? 0 : 1;
+	info->mBlockSize = dir ? 0 : LOCAL_BLOCK_SIZE;
+	info->mOwner = strdup("bench");
+	info->mGroup = strdup("bench");
+	info->mPermissions = st.st_mode & 0777;
+	info->mLastAccess = st.st_atime;
+}
+
+hdfsFileInfo* hdfsGetPathInfo(hdfsFS fs, const char* path) {
+	std::string local = local_path(path);
+	struct stat st;
+	if (stat(local.c_str(), &st) != 0) {
+		return NULL;
+	}
+	hdfsFileInfo* info = (hdfsFileInfo*)calloc(1, sizeof(hdfsFileInfo));
+	fill_info(fs, info, local, st);
+	return info;
+}
+
+hdfsFileInfo* hdfsListDirectory(hdfsFS fs, const char* path, int* cnt) {
+	*cnt = 0;
+	std::string local = local_path(path);
+	struct stat st;
+	if (stat(local.c_str(), &st) != 0) {
+		return NULL;
+	}
+	if (not S_ISDIR(st.st_mode)) {
+		hdfsFileInfo* info = (hdfsFileInfo*)calloc(1, sizeof(hdfsFileInfo));
+		fill_info(fs, info, local, st);
+		*cnt = 1;
+		return info;
+	}
+	DIR* dir = opendir(local.c_str());
+	if (dir == NULL) {
+		return NULL;
+	}
+	std::vector<std::string> names;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") != 0 and strcmp(entry->d_name, "..") != 0) {
+			names.push_back(entry->d_name);
+		}
+	}
+	closedir(dir);
+	if (names.empty()) {
+		errno = 0;
+		return NULL;
+	}
+	std::sort(names.begin(), names.end());
+	hdfsFileInfo* entries = (hdfsFileInfo*)calloc(names.size(), sizeof(hdfsFileInfo));
+	for (size_t i = 0; i < names.size(); i++) {
+		std::string child = local + "/" + names[i];
+		if (stat(child.c_str(), &st) == 0) {
+			fill_info(fs, &entries[*cnt], child, st);
+			(*cnt)++;
+		}
+	}
+	return entries;
+}
+
+void hdfsFreeFileInfo(hdfsFileInfo* entries, int cnt) {
+	if (entries == NULL) {
+		return;
+	}
+	for (int i = 0; i < cnt; i++) {
+		free(entries[i].mName);
+		free(entries[i].mOwner);
+		free(entries[i].mGroup);
+	}
+	free(entries);
+}
+
+hdfsFile hdfsOpenFile(hdfsFS fs, const char* path, int flags, int buffer_size, short replication, tSize block_size) {
+	int mode = O_RDONLY;
+	if (flags & O_WRONLY) {
+		mode = O_WRONLY | O_CREAT | ((flags & O_APPEND) ? O_APPEND : O_TRUNC);
+	}
+	int fd = ::open(local_path(path).c_str(), mode, 0644);
+	if (fd < 0) {
+		return NULL;
+	}
+	hdfsFile f = new hdfsFile_internal;
+	f->fd = fd;
+	f->flags = flags;
+	f->nread = 0;
+	return f;
+}
+
+int hdfsCloseFile(hdfsFS fs, hdfsFile f) {
+	int ret = ::close(f->fd);
+	delete f;
+	return ret == 0 ? 0 : -1;
+}
+
+int hdfsFileIsOpenForRead(hdfsFile f) {
+	return (f->flags & O_WRONLY) ? 0 : 1;
+}
+
+int hdfsFileIsOpenForWrite(hdfsFile f) {
+	return (f->flags & O_WRONLY) ? 1 : 0;
+}
+
+tSize hdfsRead(hdfsFS fs, hdfsFile f, void* buf, tSize size) {
+	tSize seen = largest_read;
+	while (size > seen and not __sync_bool_compare_and_swap(&largest_read, seen, size)) {
+		seen = largest_read;
+	}
+	ssize_t n = ::read(f->fd, buf, size);
+	if (n > 0) {
+		f->nread += n;
+	}
+	return n;
+}
+
+tSize hdfsPread(hdfsFS fs, hdfsFile f, tOffset pos, void* buf, tSize size) {
+	ssize_t n = ::pread(f->fd, buf, size, pos);
+	if (n > 0) {
+		f->nread += n;
+	}
+	return n;
+}
+
+tSize hdfsWrite(hdfsFS fs, hdfsFile f, const void* buf, tSize size) {
+	return ::write(f->fd, buf, size);
+}
+
+int hdfsFlush(hdfsFS fs, hdfsFile f) {
+	return 0;
+}
+
+int hdfsHFlush(hdfsFS fs, hdfsFile f) {
+	return 0;
+}
+
+int hdfsSeek(hdfsFS fs, hdfsFile f, tOffset pos) {
+	return lseek(f->fd, pos, SEEK_SET) < 0 ? -1 : 0;
+}
+
+tOffset hdfsTell(hdfsFS fs, hdfsFile f) {
+	return lseek(f->fd, 0, SEEK_CUR);
+}
+
+static int copy_file(const std::string &src, const std::string &dst) {
+	int in = ::open(src.c_str(), O_RDONLY);
+	if (in < 0) {
+		return -1;
+	}
+	int out = ::open(dst.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		::close(in);
+		return -1;
+	}
+	char buf[65536];
+	ssize_t n;
+	int ret = 0;
+	while ((n = ::read(in, buf, sizeof(buf))) > 0) {
+		if (::write(out, buf, n) != n) {
+			ret = -1;
+			break;
+		}
+	}
+	if (n < 0) {
+		ret = -1;
+	}
+	::close(in);
+	if (::close(out) != 0) {
+		ret = -1;
+	}
+	return ret;
+}
+
+int hdfsCopy(hdfsFS src_fs, const char* src, hdfsFS dst_fs, const char* dst) {
+	return copy_file(local_path(src), local_path(dst));
+}
+
+int hdfsMove(hdfsFS src_fs, const char* src, hdfsFS dst_fs, const char* dst) {
+	return ::rename(local_path(src).c_str(), local_path(dst).c_str()) == 0 ? 0 : -1;
+}
+
+int hdfsRename(hdfsFS fs, const char* src, const char* dst) {
+	return hdfsMove(fs, src, fs, dst);
+}
+
+static int remove_one(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+	return ::remove(path);
+}
+
+int hdfsDelete(hdfsFS fs, const char* path, int recursive) {
+	std::string local = local_path(path);
+	if (recursive) {
+		return nftw(local.c_str(), remove_one, 64, FTW_DEPTH | FTW_PHYS) == 0 ? 0 : -1;
+	}
+	return ::remove(local.c_str()) == 0 ? 0 : -1;
+}
+
+int hdfsCreateDirectory(hdfsFS fs, const char* path) {
+	std::string local = local_path(path);
+	for (size_t i = local_root.size() + 1; i <= local.size(); i++) {
+		if (i == local.size() or local[i] == '/') {
+			if (::mkdir(local.substr(0, i).c_str(), 0755) != 0 and errno != EEXIST) {
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+int hdfsSetReplication(hdfsFS fs, const char* path, int16_t replication) {
+	return hdfsExists(fs, path);
+}
+
+int hdfsChmod(hdfsFS fs, const char* path, short mode) {
+	return ::chmod(local_path(path).c_str(), mode) == 0 ? 0 : -1;
+}
+
+int hdfsChown(hdfsFS fs, const char* path, const char* owner, const char* group) {
+	return hdfsExists(fs, path);
+}
+
+int hdfsUtime(hdfsFS fs, const char* path, tTime mtime, tTime atime) {
+	struct utimbuf times;
+	times.actime = atime;
+	times.modtime = mtime;
+	return utime(local_path(path).c_str(), &times) == 0 ? 0 : -1;
+}
+
+/* one block per LOCAL_BLOCK_SIZE, all on "localhost" */
+char*** hdfsGetHosts(hdfsFS fs, const char* path, tOffset start, tOffset length) {
+	if (hdfsExists(fs, path) != 0) {
+		return NULL;
+	}
+	tOffset first = start / LOCAL_BLOCK_SIZE;
+	tOffset last = (length > 0) ? (start + length - 1) / LOCAL_BLOCK_SIZE : first;
+	int cnt = (int)(last - first + 1);
+	char*** hosts = (char***)calloc(cnt + 1, sizeof(char**));
+	for (int i = 0; i < cnt; i++) {
+		hosts[i] = (char**)calloc(2, sizeof(char*));
+		hosts[i][0] = strdup("localhost");
+	}
+	return hosts;
+}
+
+void hdfsFreeHosts(char*** hosts) {
+	for (int i = 0; hosts[i] != NULL; i++) {
+		for (int j = 0; hosts[i][j] != NULL; j++) {
+			free(hosts[i][j]);
+		}
+		free(hosts[i]);
+	}
+	free(hosts);
+}
+
+tOffset hdfsGetDefaultBlockSize(hdfsFS fs) {
+	return LOCAL_BLOCK_SIZE;
+}
+
+/* everything a local file read is local and short-circuit */
+int hdfsFileGetReadStatistics(hdfsFile f, struct hdfsReadStatistics** stats) {
+	*stats = (struct hdfsReadStatistics*)calloc(1, sizeof(struct hdfsReadStatistics));
+	if (*stats == NULL) {
+		return ENOMEM;
+	}
+	(*stats)->totalBytesRead = f->nread;
+	(*stats)->totalLocalBytesRead = f->nread;
+	(*stats)->totalShortCircuitBytesRead = f->nread;
+	return 0;
+}
+
+int64_t hdfsReadStatisticsGetRemoteBytesRead(const struct hdfsReadStatistics* stats) {
+	return stats->totalBytesRead - stats->totalLocalBytesRead;
+}
+
+void hdfsFileFreeReadStatistics(struct hdfsReadStatistics* stats) {
+	free(stats);
+}
+
+struct hadoopRzOptions* hadoopRzOptionsAlloc() {
+	return new hadoopRzOptions();
+}
+
+int hadoopRzOptionsSetSkipChecksum(struct hadoopRzOptions* opts, int skip) {
+	opts->skip_checksum = skip;
+	return 0;
+}
+
+int hadoopRzOptionsSetByteBufferPool(struct hadoopRzOptions* opts, const char* class_name) {
+	return 0;
+}
+
+void hadoopRzOptionsFree(struct hadoopRzOptions* opts) {
+	delete opts;
+}
+
+/* a copy, local reads have nothing to mmap for the module */
+struct hadoopRzBuffer* hadoopReadZero(hdfsFile f, struct hadoopRzOptions* opts, int32_t size) {
+	struct hadoopRzBuffer* buf = new hadoopRzBuffer;
+	buf->data = malloc(size);
+	ssize_t n = (buf->data != NULL) ? ::read(f->fd, buf->data, size) : -1;
+	if (n <= 0) {
+		free(buf->data);
+		buf->data = NULL;
+		n = 0;
+	}
+	buf->length = n;
+	return buf;
+}
+
+int32_t hadoopRzBufferLength(const struct hadoopRzBuffer* buf) {
+	return buf->length;
+}
+
+const void* hadoopRzBufferGet(const struct hadoopRzBuffer* buf) {
+	return buf->data;
+}
+
+void hadoopRzBufferFree(hdfsFile f, struct hadoopRzBuffer* buf) {
+	free(buf->data);
+	delete buf;
+}
+
+#ifdef __cplusplus
+}
+#endif
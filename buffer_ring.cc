@@ -0,0 +1,155 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "buffer_ring.h"
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+BUFFER_RING::BUFFER_RING(size_t size, int depth) {
+	check(size > 0 and depth > 0);
+	this->size = size;
+	this->depth = depth;
+	this->buffers.resize(depth, NULL);
+	this->lens.resize(depth, 0);
+	this->produced = 0;
+	this->consumed = 0;
+	this->waiting = 0;
+	this->closed = 0;
+	this->err = 0;
+	for (int i = 0; i < depth; i++) {
+		/* page aligned, local reads into them can go straight from the page cache */
+		void* p = NULL;
+		int ret = posix_memalign(&p, 4096, size);
+		if (ret != 0) {
+			error("posix_memalign(%zu):%s\n", size, strerror(ret));
+			this->err = ret;
+			this->closed = 1;
+			break;
+		}
+		this->buffers[i] = static_cast<char*>(p);
+	}
+	pthread_mutex_init(&this->lock, NULL);
+	pthread_cond_init(&this->cond, NULL);
+}
+
+BUFFER_RING::~BUFFER_RING() {
+	for (size_t i = 0; i < this->buffers.size(); i++) {
+		free(this->buffers[i]);
+	}
+	pthread_cond_destroy(&this->cond);
+	pthread_mutex_destroy(&this->lock);
+}
+
+size_t BUFFER_RING::buffer_size() {
+	return this->size;
+}
+
+int BUFFER_RING::status() {
+	return this->err;
+}
+
+/* a full barrier, the counters and <closed> are only read this way */
+static inline size_t load(volatile size_t* v) {
+	return __sync_fetch_and_add(v, 0);
+}
+
+static inline int load_int(volatile int* v) {
+	return __sync_fetch_and_add(v, 0);
+}
+
+/* sleeps while the ring is full (producer) or empty (consumer). <waiting>
+ * is raised before the last look at the counters, and the other side reads
+ * it after moving its counter, so a wake up can not get lost. */
+void BUFFER_RING::wait_while(bool full) {
+	pthread_mutex_lock(&this->lock);
+	__sync_fetch_and_add(&this->waiting, 1);
+	while (not load_int(&this->closed)) {
+		size_t used = load(&this->produced) - load(&this->consumed);
+		if ((full and used < this->depth) or (not full and used > 0)) {
+			break;
+		}
+		pthread_cond_wait(&this->cond, &this->lock);
+	}
+	__sync_fetch_and_sub(&this->waiting, 1);
+	pthread_mutex_unlock(&this->lock);
+}
+
+void BUFFER_RING::wake() {
+	if (load_int(&this->waiting) > 0) {
+		pthread_mutex_lock(&this->lock);
+		pthread_cond_broadcast(&this->cond);
+		pthread_mutex_unlock(&this->lock);
+	}
+}
+
+char* BUFFER_RING::next_free() {
+	if (load(&this->produced) - load(&this->consumed) == this->depth) {
+		this->wait_while(true);
+	}
+	if (load_int(&this->closed)) {
+		return NULL;
+	}
+	return this->buffers[load(&this->produced) % this->depth];
+}
+
+void BUFFER_RING::put(size_t len) {
+	check(len <= this->size);
+	this->lens[load(&this->produced) % this->depth] = len;
+	__sync_fetch_and_add(&this->produced, 1);
+	this->wake();
+}
+
+char* BUFFER_RING::next_full(size_t* len) {
+	size_t consumed = load(&this->consumed);
+	if (load(&this->produced) == consumed) {
+		this->wait_while(false);
+	}
+	if (load_int(&this->closed) or load(&this->produced) == consumed) {
+		return NULL;
+	}
+	*len = this->lens[consumed % this->depth];
+	return this->buffers[consumed % this->depth];
+}
+
+void BUFFER_RING::done() {
+	__sync_fetch_and_add(&this->consumed, 1);
+	this->wake();
+}
+
+void BUFFER_RING::close() {
+	pthread_mutex_lock(&this->lock);
+	__sync_fetch_and_or(&this->closed, 1);
+	pthread_cond_broadcast(&this->cond);
+	pthread_mutex_unlock(&this->lock);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,89 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DANGDANG_BUFFER_RING
+#define DANGDANG_BUFFER_RING
+
+#include <pthread.h>
+#include <stddef.h>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEFAULT_RING_BUFFER_SIZE (8*1024*1024)
+#define DEFAULT_RING_DEPTH 4
+
+/* a ring of <depth> buffers of <size> bytes between one producer thread and
+ * one consumer thread. the buffers only change hands by counters read and
+ * updated with atomic builtins, so passing a buffer takes no lock. the mutex
+ * and the condition are only for a side that has to sleep on a full or an
+ * empty ring, and for waking it up, which is skipped when nobody sleeps. */
+class BUFFER_RING {
+	public:
+		BUFFER_RING(size_t size, int depth);
+		~BUFFER_RING();
+
+		size_t buffer_size();
+		/* 0, or the errno of allocating the buffers; the ring is closed then */
+		int status();
+
+		/* producer: a free buffer to fill, NULL once the ring is closed */
+		char* next_free();
+		/* producer: hands the buffer over, <len> 0 marks the end of data */
+		void put(size_t len);
+
+		/* consumer: the next filled buffer, NULL once the ring is closed */
+		char* next_full(size_t* len);
+		/* consumer: gives the buffer back */
+		void done();
+
+		/* either side gives up, the other one is woken up */
+		void close();
+	private:
+		void wait_while(bool full);
+		void wake();
+
+		size_t size;
+		size_t depth;
+		std::vector<char*> buffers;
+		std::vector<size_t> lens;
+		volatile size_t produced;
+		volatile size_t consumed;
+		volatile int waiting;
+		volatile int closed;
+		int err;
+
+		pthread_mutex_t lock;
+		pthread_cond_t cond;
+};
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,240 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "classpath.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <utility>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* what one scan of share/hadoop found */
+struct classpath_scan {
+	std::vector<std::string> jars;
+	std::vector<std::pair<std::string, std::string> > dirs;  /* path, mtime */
+};
+
+static char* append(const char* s1, const char* s2) {
+	int len = strlen(s1) + strlen(s2) + 2;
+	char* curr = (char*)malloc(len);
+	memset(curr, 0, len);
+	snprintf(curr, len, "%s/%s", s1, s2);
+	return curr;
+}
+
+/* a jar added to or removed from a directory changes its mtime */
+static std::string mtime_of(const char* path) {
+	struct stat st;
+	if (stat(path, &st) != 0) {
+		return "-";
+	}
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%ld.%09ld", (long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec);
+	return buf;
+}
+
+static int scan(const char* path, classpath_scan &found) {
+	found.dirs.push_back(std::make_pair(std::string(path), mtime_of(path)));
+	struct dirent **namelist;
+	int n = scandir(path, &namelist, NULL, alphasort);
+	if (n > 0) {
+		while (n--) {
+			if (strcmp(namelist[n]->d_name, ".") == 0 or strcmp(namelist[n]->d_name, "..") == 0) {
+				free(namelist[n]);
+				continue;
+			}
+			if (namelist[n]->d_type == DT_DIR) {
+				char* pwd = append(path, namelist[n]->d_name);
+				scan(pwd, found);
+				free(pwd);
+			} else {
+				char * filename = append(path, namelist[n]->d_name);
+				if (fnmatch("*.jar", filename, 0) == 0 and \
+					fnmatch("*tomcat/webapps/*", filename, 0) != 0 and \
+					fnmatch("*mapreduce1*", filename, 0) != 0 and \
+					fnmatch("*spark*", filename, 0) != 0) {
+					found.jars.push_back(filename);
+				}
+				free(filename);
+			}
+			free(namelist[n]);
+		}
+		free(namelist);
+	} else {
+		perror(path);
+	}
+	return 0;
+}
+
+/* the version in the name of share/hadoop/common/hadoop-common-<version>.jar */
+static std::string hadoop_version(const char* libpath) {
+	std::string version = "unknown";
+	char* common = append(libpath, "common");
+	DIR* dir = opendir(common);
+	free(common);
+	if (dir == NULL) {
+		return version;
+	}
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (fnmatch("hadoop-common-*.jar", entry->d_name, 0) == 0 and fnmatch("*-tests.jar", entry->d_name, 0) != 0) {
+			std::string name = entry->d_name;
+			version = name.substr(strlen("hadoop-common-"), name.size() - strlen("hadoop-common-") - strlen(".jar"));
+			break;
+		}
+	}
+	closedir(dir);
+	return version;
+}
+
+static std::string cache_file() {
+	const char* file = getenv(CLASSPATH_CACHE_ENV);
+	if (file != NULL) {
+		return file;
+	}
+	const char* home = getenv("HOME");
+	if (home == NULL or strlen(home) == 0) {
+		return "";
+	}
+	return std::string(home) + "/" + CLASSPATH_CACHE_FILE;
+}
+
+/* the cache file is one "hadoop <version> <libpath>" line, then a
+ * "dir <mtime> <path>" line per scanned directory and a "jar <path>" line
+ * per jar. it is only used if every line still holds. */
+static bool load(const std::string &file, const std::string &key, std::vector<std::string> &jars) {
+	FILE* f = fopen(file.c_str(), "r");
+	if (f == NULL) {
+		return false;
+	}
+	bool valid = false;
+	char* line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	while ((len = ::getline(&line, &size, f)) > 0) {
+		if (line[len-1] == '\n') {
+			line[--len] = '\0';
+		}
+		if (strncmp(line, "hadoop ", 7) == 0) {
+			valid = (key == line + 7);
+		} else if (not valid) {
+			break;
+		} else if (strncmp(line, "dir ", 4) == 0) {
+			const char* path = strchr(line + 4, ' ');
+			if (path == NULL or mtime_of(path + 1) != std::string(line + 4, path - line - 4)) {
+				valid = false;
+				break;
+			}
+		} else if (strncmp(line, "jar ", 4) == 0) {
+			jars.push_back(line + 4);
+		} else {
+			valid = false;
+			break;
+		}
+	}
+	free(line);
+	fclose(f);
+	return valid;
+}
+
+/* written aside and renamed, concurrent imports never see half a file */
+static void save(const std::string &file, const std::string &key, const classpath_scan &found) {
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.%d", file.c_str(), (int)getpid());
+	FILE* f = fopen(tmp, "w");
+	if (f == NULL) {
+		return;
+	}
+	fprintf(f, "hadoop %s\n", key.c_str());
+	for (size_t i = 0; i < found.dirs.size(); i++) {
+		fprintf(f, "dir %s %s\n", found.dirs[i].second.c_str(), found.dirs[i].first.c_str());
+	}
+	for (size_t i = 0; i < found.jars.size(); i++) {
+		fprintf(f, "jar %s\n", found.jars[i].c_str());
+	}
+	if (fclose(f) != 0 or ::rename(tmp, file.c_str()) != 0) {
+		unlink(tmp);
+	}
+}
+
+static pthread_once_t classpath_once = PTHREAD_ONCE_INIT;
+static int classpath_status = 0;
+
+static void classpath_init() {
+	const char* home = getenv("HADOOP_HOME");
+	if (home == NULL or strlen(home) == 0) {
+		error("HADOOP_HOME is not set\n");
+		classpath_status = ENOENT;
+		return;
+	}
+	char* libpath = append(home, "share/hadoop");
+	std::string key = hadoop_version(libpath) + " " + libpath;
+	std::string file = cache_file();
+
+	classpath_scan found;
+	if (file.empty() or not load(file, key, found.jars)) {
+		found.jars.clear();
+		found.jars.reserve(600);
+		scan(libpath, found);
+		if (not file.empty()) {
+			save(file, key, found);
+		}
+	}
+	free(libpath);
+
+	std::string paths;
+	for (size_t i = 0; i < found.jars.size(); i++) {
+		paths += ":";
+		paths += found.jars[i];
+	}
+
+	/* a child process inherits what its parent appended */
+	const char* classpath = getenv("CLASSPATH");
+	std::string current = (classpath != NULL) ? classpath : "";
+	if (current.find(paths) == std::string::npos) {
+		setenv("CLASSPATH", (current + paths).c_str(), 1);
+	}
+}
+
+int hadoop_classpath() {
+	pthread_once(&classpath_once, classpath_init);
+	return classpath_status;
+}
+
+#ifdef __cplusplus
+}
+#endif
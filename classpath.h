@@ -0,0 +1,48 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DANGDANG_CLASSPATH
+#define DANGDANG_CLASSPATH
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* where the jar list is remembered between processes, "" turns that off.
+ * $HOME/CLASSPATH_CACHE_FILE without it. */
+#define CLASSPATH_CACHE_ENV "AWESOME_HDFS_CLASSPATH_CACHE"
+#define CLASSPATH_CACHE_FILE ".awesome_hdfs_classpath"
+
+/* appends the jars under $HADOOP_HOME/share/hadoop to $CLASSPATH. only the
+ * first call of a process does anything, and it reuses the cache file as long
+ * as the hadoop version and the mtime of every scanned directory still match.
+ * returns 0 or an errno. */
+int hadoop_classpath();
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
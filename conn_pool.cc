@@ -0,0 +1,323 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "conn_pool.h"
+#include "classpath.h"
+#include "metrics.h"
+#include "log.h"
+
+#include <string.h>
+#include <errno.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+CONN_POOL::CONN_POOL() {
+	this->port = 0;
+	this->size = DEFAULT_POOL_SIZE;
+	this->opened = 0;
+	this->warm_started = false;
+	this->warming = false;
+	this->warm_error = 0;
+	memset(&this->counters, 0, sizeof(this->counters));
+	pthread_mutex_init(&this->lock, NULL);
+	pthread_cond_init(&this->cond, NULL);
+}
+
+CONN_POOL::~CONN_POOL() {
+	this->join_warm();
+	this->drain();
+	pthread_cond_destroy(&this->cond);
+	pthread_mutex_destroy(&this->lock);
+}
+
+/* disconnects every idle connection, leased ones are closed on release */
+void CONN_POOL::drain() {
+	pthread_mutex_lock(&this->lock);
+	std::vector<idle_conn> conns;
+	conns.swap(this->idle);
+	this->opened -= conns.size();
+	pthread_mutex_unlock(&this->lock);
+
+	for (size_t i = 0; i < conns.size(); i++) {
+		timed_hdfsDisconnect(conns[i].fs);
+	}
+}
+
+/* only records where to connect to, see warmup() to connect ahead of time */
+int CONN_POOL::init(const char* host, int port, int size) {
+	check(host != NULL and size > 0);
+	this->join_warm();
+	this->drain();
+
+	pthread_mutex_lock(&this->lock);
+	this->host = host;
+	this->port = port;
+	this->size = size;
+	pthread_mutex_unlock(&this->lock);
+	return 0;
+}
+
+/* waits for a running warm-up, then reaps its thread */
+void CONN_POOL::join_warm() {
+	pthread_mutex_lock(&this->lock);
+	while (this->warming) {
+		pthread_cond_wait(&this->cond, &this->lock);
+	}
+	bool started = this->warm_started;
+	this->warm_started = false;
+	pthread_mutex_unlock(&this->lock);
+	if (started) {
+		pthread_join(this->warm_thread, NULL);
+	}
+}
+
+void* CONN_POOL::warm_main(void* arg) {
+	CONN_POOL* pool = reinterpret_cast<CONN_POOL*>(arg);
+	hdfsFS fs = pool->take(false, false);
+	int err = (fs == NULL) ? errno : 0;
+	if (fs != NULL) {
+		pool->release(fs, false);
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->warming = false;
+	pool->warm_error = err;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	return NULL;
+}
+
+/* boots the JVM and opens the first connection on a thread of its own, so
+ * the first call does not pay for it. leases wait for it instead of racing
+ * it. with <wait> it returns once that is done, 0 or an errno. */
+int CONN_POOL::warmup(bool wait) {
+	pthread_mutex_lock(&this->lock);
+	if (this->host.size() == 0 or this->port <= 0) {
+		pthread_mutex_unlock(&this->lock);
+		error("connection pool is not initialized\n");
+		return ENOTCONN;
+	}
+	if (this->warm_started and not this->warming) {
+		pthread_join(this->warm_thread, NULL);  /* it is done with the lock already */
+		this->warm_started = false;
+	}
+	if (not this->warming and this->opened == 0) {
+		this->warming = true;
+		this->warm_error = 0;
+		if (pthread_create(&this->warm_thread, NULL, CONN_POOL::warm_main, this) == 0) {
+			this->warm_started = true;
+		} else {
+			this->warming = false;
+			this->warm_error = errno;
+		}
+	}
+	while (wait and this->warming) {
+		pthread_cond_wait(&this->cond, &this->lock);
+	}
+	int ret = this->warming ? 0 : this->warm_error;
+	pthread_mutex_unlock(&this->lock);
+	return ret;
+}
+
+hdfsFS CONN_POOL::connect() {
+	hadoop_classpath();  /* the JVM reads CLASSPATH once, when the first connection boots it */
+	hdfsFS fs = timed_hdfsConnectNewInstance(this->host.c_str(), this->port);
+	pthread_mutex_lock(&this->lock);
+	if (fs == NULL) {
+		this->opened--;
+		this->counters.failures++;
+		pthread_cond_signal(&this->cond);
+	} else {
+		this->counters.connects++;
+	}
+	pthread_mutex_unlock(&this->lock);
+
+	if (fs == NULL) {
+		int err = errno;
+		error("hdfsConnectNewInstance(%s:%d):%s\n", this->host.c_str(), this->port, strerror(err));
+		errno = err;
+	}
+	return fs;
+}
+
+/* an idle connection if any, else a new one while below <size> or when
+ * <overflow> is set, else wait for a release or give up at once. */
+hdfsFS CONN_POOL::take(bool wait, bool overflow) {
+	pthread_mutex_lock(&this->lock);
+	while (true) {
+		if (this->idle.size() > 0) {
+			idle_conn c = this->idle.back();
+			this->idle.pop_back();
+			this->counters.leases++;
+			pthread_mutex_unlock(&this->lock);
+
+			if (time(NULL) - c.since < POOL_CHECK_INTERVAL or timed_hdfsExists(c.fs, "/") == 0) {
+				return c.fs;
+			}
+			warn("connection to %s:%d failed health check, reconnecting\n", this->host.c_str(), this->port);
+			timed_hdfsDisconnect(c.fs);
+			pthread_mutex_lock(&this->lock);
+			this->counters.reconnects++;
+			pthread_mutex_unlock(&this->lock);
+			return this->connect();
+		}
+		if (this->warming and wait) {
+			this->counters.waits++;
+			pthread_cond_wait(&this->cond, &this->lock);
+			continue;
+		}
+		if (this->opened < this->size or overflow) {
+			this->opened++;
+			this->counters.leases++;
+			pthread_mutex_unlock(&this->lock);
+			return this->connect();
+		}
+		if (not wait) {
+			pthread_mutex_unlock(&this->lock);
+			return NULL;
+		}
+		this->counters.waits++;
+		pthread_cond_wait(&this->cond, &this->lock);
+	}
+}
+
+hdfsFS CONN_POOL::lease() {
+	if (this->host.size() == 0 or this->port <= 0) {
+		error("connection pool is not initialized\n");
+		errno = ENOTCONN;
+		return NULL;
+	}
+	return this->take(true, false);
+}
+
+/* for callers that hold a connection for long, like an open file. it never
+ * waits, going over <size> if needed; the extra connection is closed again
+ * on release. */
+hdfsFS CONN_POOL::lease_extra() {
+	if (this->host.size() == 0 or this->port <= 0) {
+		error("connection pool is not initialized\n");
+		errno = ENOTCONN;
+		return NULL;
+	}
+	return this->take(false, true);
+}
+
+/* waits for the first connection only, then takes whatever is free up to <n> */
+size_t CONN_POOL::lease_many(size_t n, std::vector<hdfsFS> &conns) {
+	check(n > 0);
+	hdfsFS fs = this->lease();
+	if (fs == NULL) {
+		return 0;
+	}
+	conns.push_back(fs);
+	while (conns.size() < n and (fs = this->take(false, false)) != NULL) {
+		conns.push_back(fs);
+	}
+	return conns.size();
+}
+
+void CONN_POOL::release(hdfsFS fs, bool broken) {
+	check(fs != NULL);
+	pthread_mutex_lock(&this->lock);
+	if (broken or this->opened > this->size) {
+		this->opened--;
+		pthread_cond_signal(&this->cond);
+		pthread_mutex_unlock(&this->lock);
+		timed_hdfsDisconnect(fs);
+		return;
+	}
+	idle_conn c;
+	c.fs = fs;
+	c.since = time(NULL);
+	this->idle.push_back(c);
+	pthread_cond_signal(&this->cond);
+	pthread_mutex_unlock(&this->lock);
+}
+
+void CONN_POOL::release_many(std::vector<hdfsFS> &conns) {
+	for (size_t i = 0; i < conns.size(); i++) {
+		this->release(conns[i], false);
+	}
+	conns.clear();
+}
+
+/* shrinking closes idle connections now and leased ones when released */
+int CONN_POOL::resize(int size) {
+	check(size > 0);
+	std::vector<hdfsFS> extra;
+
+	pthread_mutex_lock(&this->lock);
+	this->size = size;
+	while (this->opened > this->size and this->idle.size() > 0) {
+		extra.push_back(this->idle.back().fs);
+		this->idle.pop_back();
+		this->opened--;
+	}
+	pthread_cond_broadcast(&this->cond);
+	pthread_mutex_unlock(&this->lock);
+
+	for (size_t i = 0; i < extra.size(); i++) {
+		timed_hdfsDisconnect(extra[i]);
+	}
+	return 0;
+}
+
+void CONN_POOL::stats(pool_stats* st) {
+	pthread_mutex_lock(&this->lock);
+	*st = this->counters;
+	st->size = this->size;
+	st->opened = this->opened;
+	st->idle = this->idle.size();
+	pthread_mutex_unlock(&this->lock);
+}
+
+CONN_LEASE::CONN_LEASE(CONN_POOL* pool) {
+	this->pool = pool;
+	this->broken = false;
+	this->fs = pool->lease();
+}
+
+CONN_LEASE::~CONN_LEASE() {
+	if (this->fs != NULL) {
+		this->pool->release(this->fs, this->broken);
+	}
+}
+
+/* libhdfs maps an IOException of a dead or closed filesystem to EIO, such a
+ * connection goes back to the pool as broken and gets replaced. */
+int CONN_LEASE::result(int ret) {
+	if (ret == -1 and errno == EIO) {
+		this->broken = true;
+	}
+	return ret;
+}
+
+void CONN_LEASE::fail() {
+	this->broken = true;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,118 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DANGDANG_CONN_POOL
+#define DANGDANG_CONN_POOL
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hdfs.h"
+
+#define DEFAULT_POOL_SIZE   8
+#define POOL_CHECK_INTERVAL 60  /* seconds a connection may idle before it is probed again */
+
+struct pool_stats {
+	uint64_t leases;
+	uint64_t waits;
+	uint64_t connects;
+	uint64_t reconnects;
+	uint64_t failures;
+	int size;
+	int opened;
+	int idle;
+};
+
+/* at most <size> hdfsConnectNewInstance handles, each leased by one caller at
+ * a time. connections are opened on demand, probed after idling, and dropped
+ * when the caller reports them broken, so the next lease reconnects. nothing
+ * is connected, and no JVM started, before the first lease or warmup(). */
+class CONN_POOL {
+	public:
+		CONN_POOL();
+		~CONN_POOL();
+
+		int init(const char* host, int port, int size);
+		hdfsFS lease();
+		hdfsFS lease_extra();
+		size_t lease_many(size_t n, std::vector<hdfsFS> &conns);
+		void release(hdfsFS fs, bool broken);
+		void release_many(std::vector<hdfsFS> &conns);
+		int resize(int size);
+		int warmup(bool wait);
+		void stats(pool_stats* st);
+	private:
+		struct idle_conn {
+			hdfsFS fs;
+			time_t since;
+		};
+		hdfsFS connect();
+		hdfsFS take(bool wait, bool overflow);
+		void drain();
+		void join_warm();
+		static void* warm_main(void* arg);
+
+		std::string host;
+		int port;
+		int size;
+		int opened;
+		std::vector<idle_conn> idle;
+		pool_stats counters;
+		pthread_t warm_thread;
+		bool warm_started;  /* warm_thread is yet to be joined */
+		bool warming;       /* warm_thread is connecting */
+		int warm_error;
+
+		pthread_mutex_t lock;
+		pthread_cond_t cond;
+};
+
+/* holds one connection for the lifetime of a call */
+class CONN_LEASE {
+	public:
+		CONN_LEASE(CONN_POOL* pool);
+		~CONN_LEASE();
+
+		int result(int ret);
+		void fail();
+		hdfsFS fs;
+	private:
+		CONN_POOL* pool;
+		bool broken;
+};
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -23,99 +23,59 @@ SOFTWARE.
 */
 
 #include "hadoop_fs.h"
+#include "task_queue.h"
+#include "buffer_ring.h"
+#include "meta_cache.h"
+#include "conn_pool.h"
+#include "metrics.h"
 #include "log.h"
 
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <dirent.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <fnmatch.h>
 #include <string>
 #include <libgen.h>
+#include <pthread.h>
 #include <vector>
+#include <set>
+#include <map>
+#include <algorithm>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-HDFS_FILE::HDFS_FILE() {
+HDFS_FILE::HDFS_FILE() : stream(&pool, &cache, &read_stats) {
 	this->init("", 0);
 }
 
-HDFS_FILE::HDFS_FILE(const char* host, const int port) {
+HDFS_FILE::HDFS_FILE(const char* host, const int port) : stream(&pool, &cache, &read_stats) {
 	this->init(host, port);
 }
 
+/* connections are opened by the pool, this opens the first one right away
+ * so that a wrong host or port shows up at once. */
 int HDFS_FILE::connect(const char* host, int port) {
+	METRIC_SCOPE m(METRIC_CONNECT);
 	check(host != NULL and strlen(host) > 0 and port > 0);
-	check(this->connection == NULL);
-
-	this->connection = hdfsConnect(this->host.c_str(), this->port);
-	if (this->connection == NULL) {
-		error(strerror(errno));
-		return errno;
-	}
-
-	return 0;
-}
-
-static char* append(const char* s1, const char* s2) {
-	int len = strlen(s1) + strlen(s2) + 2;
-	char* curr = (char*)malloc(len);
-	memset(curr, 0, len);
-	snprintf(curr, len, "%s/%s", s1, s2);
-	return curr;
-}
-
-static int scan(const char* path, std::vector<std::string> &libjars) {
-	struct dirent **namelist;
-	int n = scandir(path, &namelist, NULL, alphasort);
-	if (n > 0) {
-		while (n--) {
-			if (strcmp(namelist[n]->d_name, ".") == 0 or strcmp(namelist[n]->d_name, "..") == 0) {
-				free(namelist[n]);
-				continue;
-			}
-			if (namelist[n]->d_type == DT_DIR) {
-				char* pwd = append(path, namelist[n]->d_name);
-				scan(pwd, libjars);
-				free(pwd);
-			} else {
-				char * filename = append(path, namelist[n]->d_name);
-				if (fnmatch("*.jar", filename, 0) == 0 and \
-					fnmatch("*tomcat/webapps/*", filename, 0) != 0 and \
-					fnmatch("*mapreduce1*", filename, 0) != 0 and \
-					fnmatch("*spark*", filename, 0) != 0) {
-					libjars.push_back(filename);
-				}
-				free(filename);
-			}
-			free(namelist[n]);
-		}
-		free(namelist);
-	} else {
-		perror(path);
+	int ret = this->pool.init(host, port, DEFAULT_POOL_SIZE);
+	if (ret != 0) {
+		return ret;
 	}
-	return 0;
+	CONN_LEASE conn(&this->pool);
+	return (conn.fs == NULL) ? errno : 0;
 }
 
-void HDFS_FILE::hadoop_env() {
-
-	std::vector<std::string> libjars;
-	libjars.reserve(600);
-	char* libpath = append(getenv("HADOOP_HOME"), "share/hadoop");
-	scan(libpath, libjars);
-	free(libpath);
-
-	std::string paths;
-	for (size_t i = 0; i < libjars.size(); i++) {
-		paths += ":";
-		paths += libjars[i];
-	}
-
-	std::string classpath = getenv("CLASSPATH");
-	setenv("CLASSPATH", (classpath+":"+paths).c_str(), 1);
+/* starts the JVM and the first connection in the background, see CONN_POOL */
+int HDFS_FILE::warmup(bool wait) {
+	return this->pool.warmup(wait);
 }
 
 int HDFS_FILE::init(const char* host, const int port) {
@@ -123,112 +83,71 @@ int HDFS_FILE::init(const char* host, const int port) {
 	this->host = host;
 	this->port = port;
 
-	this->_f = NULL;
-	this->connection = NULL;
-
-	memset(this->buffer, 0, sizeof(this->buffer));
-	this->current = this->buffer;
-	this->eof = false;
-
-	this->hadoop_env();
-
-	if (this->host.size() > 0 and this->port > 0) {
-		this->connect(this->host.c_str(), this->port);
-	}
+	this->parallelism = DEFAULT_PARALLELISM;
+	this->read_buffer = DEFAULT_STREAM_BUFFER_SIZE;
+	this->readahead = true;
+	this->write_buffer = DEFAULT_WRITE_BUFFER_SIZE;
+	this->put_buffer = DEFAULT_RING_BUFFER_SIZE;
+	this->put_depth = DEFAULT_RING_DEPTH;
 
-	return 0;
+	/* nothing connects before the first call needs it, or warmup() */
+	return this->pool.init(host, port, DEFAULT_POOL_SIZE);
 }
 
 HDFS_FILE::~HDFS_FILE() {
-	if (this->_f != NULL) {
+	if (this->stream.is_open()) {
 		this->close();
 	}
-	if (this->connection != NULL) {
-		hdfsDisconnect(this->connection);
-		this->connection = NULL;
-	}
 }
 
 size_t HDFS_FILE::read(void* buf, size_t size) {
-	check(this->connection != NULL and this->_f != NULL and size > 0);
-	tSize bytes = hdfsRead(this->connection, this->_f, buf, size);
-	if (bytes == -1) {
-		error(strerror(errno));
-		return 0;
-	}
-	return static_cast<size_t>(bytes);
+	METRIC_SCOPE m(METRIC_READ);
+	size_t n = this->stream.read(buf, size);
+	m.add_bytes(n);
+	return n;
 }
 
-char HDFS_FILE::buffered_chars() {
-	check(this->connection != NULL and this->_f != NULL);
-
-	if (this->current == this->buffer+sizeof(this->buffer)-1 or this->current == this->buffer) {
-		memset(this->buffer, 0, sizeof(this->buffer));
-		tSize bytes = hdfsRead(this->connection, this->_f, this->buffer, sizeof(this->buffer));
-		if (bytes == -1) {
-			error(strerror(errno));
-			return 0;
-		}
-		this->current = this->buffer;
-	}
-
-	char ch = *(this->current);
-	this->current++;
-
-	return ch;
+/* <size> bytes unless the file ends first, -1 with errno set on error */
+ssize_t HDFS_FILE::read_bytes(void* buf, size_t size) {
+	METRIC_SCOPE m(METRIC_READ_BYTES);
+	ssize_t n = this->stream.read_fully(buf, size);
+	m.add_bytes(n);
+	return n;
 }
 
 char* HDFS_FILE::getline() {
-	check(this->connection != NULL and this->_f != NULL);
-
-	size_t max_len = 1024*sizeof(char);
-	char* line = (char*)malloc(max_len);
-	memset(line, 0, max_len);
-	char* ptr = line;
-
-	while (true) {
-		if (this->eof) {
-			memset(line, 0, max_len);
-			return line;
-		}
-		char ch = this->buffered_chars();
-		*ptr = ch;
-		if (ch == '\0') {
-			this->eof = true;
-			break;
-		}
-		if (ptr == line+max_len-1) {
-			line = (char*)realloc(line, max_len*2);
-			ptr = line+max_len;
-			max_len = max_len*2;
-		}
-		if (*ptr == '\n') {
-			*(ptr+1) = 0;
-			return line;
-		}
-		ptr++;
-	}
+	METRIC_SCOPE m(METRIC_GETLINE);
+	return this->stream.getline(NULL);
+}
 
-	return line;
+/* the line may hold NUL bytes, <len> is its real length, 0 at end of file */
+char* HDFS_FILE::getline(ssize_t* len) {
+	METRIC_SCOPE m(METRIC_GETLINE);
+	return this->stream.getline(len);
 }
 
+/* the stream behind open(), for callers that read lines in place */
+HDFS_STREAM* HDFS_FILE::file() {
+	return &this->stream;
+}
 
 size_t HDFS_FILE::write(void* line) {
+	METRIC_SCOPE m(METRIC_WRITE);
 	const char *_line = reinterpret_cast<const char*>(line);
-	int size = strlen(_line);
-	if (size == 0) {
-		return 0;
-	}
+	size_t n = this->stream.write(_line, strlen(_line));
+	m.add_bytes(n);
+	return n;
+}
 
-	tSize nwrite = hdfsWrite(this->connection, this->_f, _line, size);
-	if (nwrite == -1) {
-		error(strerror(errno));
-		return 0;
-	}
-	return static_cast<size_t>(nwrite);
+/* binary data, NUL bytes included */
+size_t HDFS_FILE::write(const void* buf, size_t size) {
+	METRIC_SCOPE m(METRIC_WRITE);
+	size_t n = this->stream.write(buf, size);
+	m.add_bytes(n);
+	return n;
 }
 
-static bool contains_wildchars(std::string &path) {
+static bool contains_wildchars(const std::string &path) {
 	return (
 		path.find('*') != std::string::npos or
 		path.find('[') != std::string::npos or
@@ -237,41 +156,6 @@ static bool contains_wildchars(std::string &path) {
 	);
 }
 
-bool HDFS_FILE::match(std::vector<std::string> &fields) {
-	check(fields.size() > 3);
-
-	std::string path = "";
-	for (size_t i = 0; i < fields.size(); i++) {
-		if (contains_wildchars(fields[i])) {
-			int cnt = 0;
-			hdfsFileInfo* fs = hdfsListDirectory(this->connection, path.c_str(), &cnt);
-			bool found = false;
-			for(int j = 0; j < cnt; j++) {
-				if (strcmp((path+"/_SUCCESS").c_str(), fs[j].mName) == 0) {
-					continue;
-				}
-				if (fnmatch((path+fields[i]).c_str(), fs[j].mName, 0)  == 0) {
-					path = fs[j].mName;
-					found = true;
-					break;
-				}
-			}
-			hdfsFreeFileInfo(fs, cnt);
-			if (found == false) {
-				return false;
-			}
-		} else {
-			path += fields[i];
-		}
-	}
-	int st = hdfsExists(this->connection, path.c_str());
-	if (st == -1) {
-		return false;
-	}
-	return true;
-}
-
-
 std::string remove_double_slash(std::string path) {
 	char* p = (char*)malloc(sizeof(char)*strlen(path.c_str())+1);
 	char* ptr = p;
@@ -304,114 +188,607 @@ std::string HDFS_FILE::add_schema(std::string path) {
 	return full_path;
 }
 
-int split_by_wildchars(const char* path, std::vector<std::string> &fields) {
-	char buffer[128];
-	memset(buffer, 0, 128);
-	char* p = buffer;
-	int left = -1;
-	int right = -1;
-	for (size_t i = 0 ; i < strlen(path); i++) {
-		if (path[i] == '{' or path[i] == '[') {
-			if (left < 0) {
-				left = i;
-			}
-		}
-		if (path[i] == '}' or path[i] == ']') {
+/* expands {a,b} alternatives (nested ones too) into plain fnmatch patterns,
+ * a '{' without its '}' is kept as it is. */
+static void expand_braces(const std::string &pattern, std::vector<std::string> &out) {
+	size_t left = pattern.find('{');
+	if (left == std::string::npos) {
+		out.push_back(pattern);
+		return;
+	}
+
+	std::vector<std::string> alternatives;
+	size_t start = left + 1;
+	size_t right = std::string::npos;
+	int depth = 0;
+	for (size_t i = left + 1; i < pattern.size(); i++) {
+		if (pattern[i] == '{') {
+			depth++;
+		} else if (pattern[i] == '}' and depth > 0) {
+			depth--;
+		} else if (pattern[i] == '}') {
+			alternatives.push_back(pattern.substr(start, i - start));
 			right = i;
+			break;
+		} else if (pattern[i] == ',' and depth == 0) {
+			alternatives.push_back(pattern.substr(start, i - start));
+			start = i + 1;
+		}
+	}
+	if (right == std::string::npos) {
+		out.push_back(pattern);
+		return;
+	}
+
+	std::string head = pattern.substr(0, left);
+	std::string tail = pattern.substr(right + 1);
+	for (size_t i = 0; i < alternatives.size(); i++) {
+		expand_braces(head + alternatives[i] + tail, out);
+	}
+}
+
+static void split_path(const std::string &path, std::vector<std::string> &fields) {
+	size_t start = 0;
+	while (start < path.size()) {
+		size_t end = path.find('/', start);
+		if (end == std::string::npos) {
+			end = path.size();
+		}
+		if (end > start) {
+			fields.push_back(path.substr(start, end - start));
+		}
+		start = end + 1;
+	}
+}
+
+static std::string join(const std::string &dir, const std::string &name) {
+	if (dir.size() > 0 and dir[dir.size()-1] == '/') {
+		return dir + name;
+	}
+	return dir + "/" + name;
+}
+
+static std::string path_of(const std::string &uri) {
+	size_t schema = uri.find("://");
+	size_t root = uri.find('/', schema == std::string::npos ? 0 : schema + 3);
+	return (root == std::string::npos) ? "/" : uri.substr(root);
+}
+
+static const char* base_name(const char* path) {
+	const char* name = strrchr(path, '/');
+	return (name == NULL) ? path : name + 1;
+}
+
+/* hdfsGetPathInfo through <cache>, only "not found" is remembered as negative */
+static hdfsFileInfo* cached_stat(META_CACHE* cache, hdfsFS fs, const char* path) {
+	hdfsFileInfo* info = NULL;
+	if (cache->get_info(path, &info)) {
+		return info;
+	}
+	info = timed_hdfsGetPathInfo(fs, path);
+	if (info != NULL or errno == ENOENT) {
+		cache->put_info(path, info);
+	}
+	return info;
+}
+
+static hdfsFileInfo* cached_list(META_CACHE* cache, hdfsFS fs, const char* path, int* cnt) {
+	hdfsFileInfo* entries = NULL;
+	*cnt = 0;
+	if (cache->get_list(path, &entries, cnt)) {
+		return entries;
+	}
+	errno = 0;
+	entries = timed_hdfsListDirectory(fs, path, cnt);
+	if (entries != NULL or errno == 0 or errno == ENOENT) {
+		cache->put_list(path, entries, *cnt);
+	}
+	return entries;
+}
+
+struct glob_state {
+	std::vector<std::vector<std::string> > patterns;
+	glob_callback cb;
+	void* ctx;
+	size_t limit;
+	META_CACHE* cache;
+	std::set<std::string> found;
+	pthread_mutex_t lock;
+};
+
+struct glob_task {
+	glob_state* state;
+	size_t pattern;
+	size_t field;
+	std::string path;
+};
+
+static void glob_step(TASK_QUEUE* queue, hdfsFS fs, void* arg);
+
+static void glob_push(TASK_QUEUE* queue, glob_task* parent, size_t field, const char* path) {
+	glob_task* t = new glob_task;
+	t->state = parent->state;
+	t->pattern = parent->pattern;
+	t->field = field;
+	t->path = path;
+	queue->push(glob_step, t);
+}
+
+static void glob_emit(TASK_QUEUE* queue, glob_state* state, const std::string &path) {
+	pthread_mutex_lock(&state->lock);
+	if (state->limit == 0 or state->found.size() < state->limit) {
+		if (state->found.insert(path).second) {
+			state->cb(path.c_str(), state->ctx);
 		}
-		if (path[i] == '/') {
-			if (left > 0 and right < 0) {
-				continue;
+	}
+	if (state->limit > 0 and state->found.size() >= state->limit) {
+		queue->stop();
+	}
+	pthread_mutex_unlock(&state->lock);
+}
+
+/* matches fields[field] against the listing of one directory. "**" stands for
+ * any number of directories, so it recurses into every child directory and
+ * also tries the next field on this same listing instead of listing the
+ * directory again. wildcards, "**" included, never match _SUCCESS. */
+static void glob_match(TASK_QUEUE* queue, glob_task* t, size_t field, hdfsFileInfo* fs, int cnt) {
+	const std::vector<std::string> &fields = t->state->patterns[t->pattern];
+	bool last = (field + 1 == fields.size());
+
+	if (fields[field] == "**") {
+		for (int i = 0; i < cnt; i++) {
+			if (last and strcmp(base_name(fs[i].mName), "_SUCCESS") != 0) {
+				glob_emit(queue, t->state, fs[i].mName);
 			}
-			if (strlen(buffer) > 0) {
-				fields.push_back(buffer);
+			if (fs[i].mKind == kObjectKindDirectory) {
+				glob_push(queue, t, field, fs[i].mName);
 			}
-			memset(buffer, 0, 128);
-			p = buffer;
-			left = -1;
-			right = -1;
 		}
-		*p++ = path[i];
+		if (not last) {
+			glob_match(queue, t, field + 1, fs, cnt);
+		}
+		return;
+	}
+
+	std::string pattern = fields[field];
+	bool wild = contains_wildchars(pattern);
+	for (int i = 0; i < cnt; i++) {
+		const char* name = base_name(fs[i].mName);
+		if (wild and strcmp(name, "_SUCCESS") == 0) {
+			continue;
+		}
+		if (fnmatch(pattern.c_str(), name, 0) != 0) {
+			continue;
+		}
+		if (last) {
+			glob_emit(queue, t->state, fs[i].mName);
+		} else if (fs[i].mKind == kObjectKindDirectory) {
+			glob_push(queue, t, field + 1, fs[i].mName);
+		}
+	}
+}
+
+/* literal fields cost nothing: they are appended until the next wildcard,
+ * which needs one listing, or the end of the pattern, which needs one exists. */
+static void glob_step(TASK_QUEUE* queue, hdfsFS fs, void* arg) {
+	glob_task* t = reinterpret_cast<glob_task*>(arg);
+	if (queue->stopped()) {
+		delete t;
+		return;
+	}
+
+	const std::vector<std::string> &fields = t->state->patterns[t->pattern];
+	std::string path = t->path;
+	size_t field = t->field;
+	while (field < fields.size() and fields[field] != "**" and not contains_wildchars(fields[field])) {
+		path = join(path, fields[field]);
+		field++;
+	}
+
+	if (field == fields.size()) {
+		hdfsFileInfo* info = cached_stat(t->state->cache, fs, path.c_str());
+		if (info != NULL) {
+			glob_emit(queue, t->state, path);
+			hdfsFreeFileInfo(info, 1);
+		}
+	} else {
+		int cnt = 0;
+		hdfsFileInfo* entries = cached_list(t->state->cache, fs, path.c_str(), &cnt);
+		/* listing a file gives the file itself, it has no children to match */
+		bool file = (entries != NULL and cnt == 1 and entries[0].mKind != kObjectKindDirectory and
+				path_of(entries[0].mName) == path_of(path));
+		if (entries != NULL and not file) {
+			glob_match(queue, t, field, entries, cnt);
+			hdfsFreeFileInfo(entries, cnt);
+		}
+	}
+	delete t;
+}
+
+int HDFS_FILE::set_parallelism(int n) {
+	check(n > 0);
+	this->parallelism = n;
+	return 0;
+}
+
+int HDFS_FILE::set_pool_size(int n) {
+	check(n > 0);
+	return this->pool.resize(n);
+}
+
+/* put(), put_many() and put_tree() read local files ahead into <depth>
+ * buffers of <size> bytes */
+int HDFS_FILE::set_put_buffers(size_t size, int depth) {
+	check(size > 0 and depth > 0);
+	this->put_buffer = size;
+	this->put_depth = depth;
+	return 0;
+}
+
+/* applies to streams opened from now on and to the module-level file */
+int HDFS_FILE::set_read_buffer(size_t size, bool readahead) {
+	check(size > 0);
+	this->read_buffer = size;
+	this->readahead = readahead;
+	this->stream.configure(size, readahead);
+	return 0;
+}
+
+/* small writes are combined up to <size> bytes, 0 sends every write on its own */
+int HDFS_FILE::set_write_buffer(size_t size) {
+	this->write_buffer = size;
+	this->stream.configure_write(size);
+	return 0;
+}
+
+/* every match of <pattern> is handed to <cb> as soon as it is found, listings of
+ * all pending branches are spread over up to <parallelism> pooled connections.
+ * stops after <limit> matches unless <limit> is 0. returns the number of matches. */
+size_t HDFS_FILE::glob(const char* pattern, glob_callback cb, void* ctx, size_t limit) {
+	METRIC_SCOPE m(METRIC_GLOB);
+	check(pattern != NULL and strlen(pattern) > 0 and cb != NULL);
+
+	std::string full = remove_double_slash(add_schema(pattern));
+	size_t schema = full.find("://");
+	size_t root = full.find('/', schema == std::string::npos ? 0 : schema + 3);
+	if (root == std::string::npos) {
+		root = full.size();
 	}
-	if (p != buffer and strcmp(buffer, "/") != 0) {
-		fields.push_back(buffer);
+
+	std::vector<std::string> patterns;
+	expand_braces(full.substr(root), patterns);
+
+	glob_state state;
+	state.cb = cb;
+	state.ctx = ctx;
+	state.limit = limit;
+	state.cache = &this->cache;
+	pthread_mutex_init(&state.lock, NULL);
+	state.patterns.resize(patterns.size());
+
+	std::vector<hdfsFS> conns;
+	if (this->pool.lease_many(contains_wildchars(full) ? this->parallelism : 1, conns) == 0) {
+		pthread_mutex_destroy(&state.lock);
+		return 0;
 	}
-	return fields.size();
+	TASK_QUEUE queue(conns);
+	for (size_t i = 0; i < patterns.size(); i++) {
+		split_path(patterns[i], state.patterns[i]);
+		glob_task* t = new glob_task;
+		t->state = &state;
+		t->pattern = i;
+		t->field = 0;
+		t->path = full.substr(0, root) + "/";
+		queue.push(glob_step, t);
+	}
+	queue.run();
+	this->pool.release_many(conns);
+
+	pthread_mutex_destroy(&state.lock);
+	return state.found.size();
+}
+
+static void collect(const char* path, void* ctx) {
+	reinterpret_cast<std::vector<std::string>*>(ctx)->push_back(path);
+}
+
+size_t HDFS_FILE::glob(const char* pattern, std::vector<std::string> &matches) {
+	size_t cnt = this->glob(pattern, collect, &matches, 0);
+	std::sort(matches.begin(), matches.end());
+	return cnt;
+}
+
+static void ignore(const char* path, void* ctx) {
 }
 
 bool HDFS_FILE::exist(const char* path) {
+	METRIC_SCOPE m(METRIC_EXIST);
 	check(path != NULL and strlen(path) > 0);
-	check(this->connection != NULL);
 
-	std::vector<std::string> fields;
-	split_by_wildchars(remove_double_slash(add_schema(path)).c_str(), fields);
-
-	return match(fields);
+	return this->glob(path, ignore, NULL, 1) > 0;
 }
 
+/* strips "hdfs://host:port" so names listed by the namenode compare with ours */
+struct exist_group {
+	std::string parent;
+	std::string dir;
+	std::vector<std::string> names;
+	std::vector<size_t> index;
+	std::vector<char>* result;
+	META_CACHE* cache;
+};
+
+/* a lone path costs one exists, siblings share a single listing of their parent */
+static void exist_step(TASK_QUEUE* queue, hdfsFS fs, void* arg) {
+	exist_group* g = reinterpret_cast<exist_group*>(arg);
+	std::vector<char> &result = *g->result;
+
+	if (g->names.size() == 1) {
+		hdfsFileInfo* info = cached_stat(g->cache, fs, join(g->parent, g->names[0]).c_str());
+		result[g->index[0]] = (info != NULL);
+		if (info != NULL) {
+			hdfsFreeFileInfo(info, 1);
+		}
+		return;
+	}
 
-int HDFS_FILE::open(const char* path, const char* mode) {
-	check(strlen(path) > 0);
-	check(this->_f == NULL and this->connection != NULL);
+	int cnt = 0;
+	hdfsFileInfo* entries = cached_list(g->cache, fs, g->parent.c_str(), &cnt);
+	std::set<std::string> children;
+	for (int i = 0; i < cnt; i++) {
+		/* a file lists as itself, so only keep entries really under <parent> */
+		std::string entry = path_of(entries[i].mName);
+		if (entry.size() > g->dir.size() and entry.compare(0, g->dir.size(), g->dir) == 0) {
+			children.insert(entry.substr(g->dir.size()));
+		}
+	}
+	if (entries != NULL) {
+		hdfsFreeFileInfo(entries, cnt);
+	}
+	for (size_t i = 0; i < g->names.size(); i++) {
+		result[g->index[i]] = (children.count(g->names[i]) > 0);
+	}
+}
 
-	char fname[1024];
-	snprintf(fname, sizeof(fname)-1, "hdfs://%s:%d%s", this->host.c_str(), this->port, path);
+/* answers exist() for every path in one go, <result> follows the order of
+ * <paths>. plain paths are grouped by parent directory and the groups are
+ * checked concurrently, patterns go through glob() one by one. */
+int HDFS_FILE::exist_many(const std::vector<std::string> &paths, std::vector<bool> &result) {
+	METRIC_SCOPE m(METRIC_EXIST_MANY);
+	std::vector<char> found(paths.size(), 0);
+	std::map<std::string, exist_group> groups;
+	std::vector<size_t> patterns;
+
+	for (size_t i = 0; i < paths.size(); i++) {
+		std::string path = remove_double_slash(add_schema(paths[i]));
+		if (contains_wildchars(path)) {
+			patterns.push_back(i);
+			continue;
+		}
+		while (path.size() > 0 and path[path.size()-1] == '/') {
+			path = path.substr(0, path.size()-1);
+		}
+		size_t slash = path.rfind('/');
+		size_t schema = path.find("://");
+		if (slash == std::string::npos or (schema != std::string::npos and slash < schema + 3)) {
+			patterns.push_back(i); /* the root has no parent to list */
+			continue;
+		}
+		exist_group &g = groups[path.substr(0, slash + 1)];
+		g.parent = path.substr(0, slash + 1);
+		g.dir = path_of(g.parent);
+		g.names.push_back(path.substr(slash + 1));
+		g.index.push_back(i);
+		g.result = &found;
+		g.cache = &this->cache;
+	}
 
-	int flag = 0;
-	if (!strcmp(mode, "r")) {
-		flag = O_RDONLY;
-	} else if (!strcmp(mode, "w"))  {
-		flag = O_WRONLY;
-	} else if (!strcmp(mode, "a"))  {
-		flag = O_WRONLY | O_APPEND;
-	} else {
-		error("Unknown mode:%s", mode);
-		return false;
+	std::vector<hdfsFS> conns;
+	if (groups.size() > 0 and this->pool.lease_many(std::min(groups.size(), static_cast<size_t>(this->parallelism)), conns) > 0) {
+		TASK_QUEUE queue(conns);
+		for (std::map<std::string, exist_group>::iterator it = groups.begin(); it != groups.end(); ++it) {
+			queue.push(exist_step, &it->second);
+		}
+		queue.run();
+		this->pool.release_many(conns);
 	}
-	
-	this->_f = hdfsOpenFile(this->connection, fname, flag, 0, 0, 0);
-	if (this->_f == NULL) {
-		error(strerror(errno));
+
+	for (size_t i = 0; i < patterns.size(); i++) {
+		found[patterns[i]] = this->exist(paths[patterns[i]].c_str());
 	}
 
+	result.assign(found.begin(), found.end());
 	return 0;
 }
 
 
-void HDFS_FILE::close() {
-	check(this->_f != NULL and this->connection != NULL);
+std::string HDFS_FILE::open_path(const char* path) {
+	char fname[1024];
+	snprintf(fname, sizeof(fname)-1, "hdfs://%s:%d%s", this->host.c_str(), this->port, path);
+	return fname;
+}
 
-	if (hdfsCloseFile(this->connection, this->_f) == -1) {
-		error(strerror(errno));
-	}
+/* the module-level file, see open_stream() for files of their own */
+int HDFS_FILE::open(const char* path, const char* mode) {
+	METRIC_SCOPE m(METRIC_OPEN);
+	check(strlen(path) > 0);
+	return this->stream.open(this->open_path(path).c_str(), mode);
+}
 
-	this->_f = NULL;
-	this->current = NULL;
-	this->buffer[0] = '\0';
+/* a new stream on its own pooled connection, NULL with errno set on failure.
+ * the caller deletes it, which closes it if still open. */
+HDFS_STREAM* HDFS_FILE::open_stream(const char* path, const char* mode) {
+	METRIC_SCOPE m(METRIC_OPEN_STREAM);
+	check(path != NULL and strlen(path) > 0);
+	HDFS_STREAM* f = new HDFS_STREAM(&this->pool, &this->cache, &this->read_stats);
+	f->configure(this->read_buffer, this->readahead);
+	f->configure_write(this->write_buffer);
+	int err = f->open(this->open_path(path).c_str(), mode);
+	if (err != 0) {
+		delete f;
+		errno = err;
+		return NULL;
+	}
+	return f;
 }
 
+void HDFS_FILE::close() {
+	METRIC_SCOPE m(METRIC_CLOSE);
+	this->stream.close();
+}
 
 int HDFS_FILE::flush() {
-	check(this->_f != NULL and this->connection != NULL);
-	check(hdfsFileIsOpenForWrite(this->_f) == 0);
+	METRIC_SCOPE m(METRIC_FLUSH);
+	return this->stream.flush();
+}
 
-	return hdfsFlush(this->connection, this->_f);
+/* drops whatever the cache knows about <path>, its subtree and its parent.
+ * mutations call it after their rpc returns, failed or not: a lookup racing
+ * an earlier invalidation could otherwise cache the old state for a ttl. */
+void HDFS_FILE::invalidate(const char* path) {
+	this->cache.invalidate(remove_double_slash(add_schema(path)));
 }
 
 int HDFS_FILE::cp(const char* src, const char* dst) {
-	check(src != NULL and dst != NULL and this->connection != NULL);
+	METRIC_SCOPE m(METRIC_CP);
+	check(src != NULL and dst != NULL);
 	check(strcmp(src, dst) != 0);
-	return hdfsCopy(this->connection, src, this->connection, dst);
+	CONN_LEASE conn(&this->pool);
+	if (conn.fs == NULL) {
+		return errno;
+	}
+	int ret = conn.result(timed_hdfsCopy(conn.fs, src, conn.fs, dst));
+	this->invalidate(dst);
+	return ret;
 }
 
 int HDFS_FILE::mv(const char* src, const char* dst) {
-	check(src != NULL and dst != NULL and this->connection != NULL);
+	METRIC_SCOPE m(METRIC_MV);
+	check(src != NULL and dst != NULL);
 	check(strcmp(src, dst) != 0);
-	return hdfsMove(this->connection, src, this->connection, dst);
+	CONN_LEASE conn(&this->pool);
+	if (conn.fs == NULL) {
+		return errno;
+	}
+	int ret = conn.result(timed_hdfsMove(conn.fs, src, conn.fs, dst));
+	this->invalidate(src);
+	this->invalidate(dst);
+	return ret;
+}
+
+static int write_all(hdfsFS fs, hdfsFile f, const char* buf, size_t len) {
+	for (size_t off = 0; off < len; ) {
+		tSize nwrite = timed_hdfsWrite(fs, f, buf + off, len - off);
+		if (nwrite < 0) {
+			return errno;
+		}
+		off += nwrite;
+	}
+	return 0;
+}
+
+/* fills <buf> with up to <size> bytes of <fd>, short only at the end of file */
+static ssize_t read_full(int fd, char* buf, size_t size) {
+	size_t len = 0;
+	while (len < size) {
+		ssize_t n = ::read(fd, buf + len, size - len);
+		if (n < 0 and errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			return -1;
+		}
+		if (n == 0) {
+			break;
+		}
+		len += n;
+	}
+	return len;
+}
+
+/* called after every buffer copy_to_hdfs() has written */
+typedef void (*write_hook)(size_t bytes, void* ctx);
+
+struct pipe_reader {
+	int fd;
+	BUFFER_RING* ring;
+	int err;
+};
+
+static void* pipe_read(void* arg) {
+	pipe_reader* r = reinterpret_cast<pipe_reader*>(arg);
+	char* buf = NULL;
+	while ((buf = r->ring->next_free()) != NULL) {
+		ssize_t len = read_full(r->fd, buf, r->ring->buffer_size());
+		if (len < 0) {
+			r->err = errno;
+			r->ring->close();
+			break;
+		}
+		r->ring->put(len);
+		if (len == 0) {
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* writes the local file <fd> to the hdfs file <f>, 0 or an errno. a file
+ * bigger than one buffer is read by a thread of its own into a ring of
+ * <depth> buffers of <size> bytes while this thread writes them out, so
+ * local reads overlap with the datanode pipeline. */
+static int copy_to_hdfs(hdfsFS fs, hdfsFile f, int fd, size_t size, int depth, write_hook hook, void* ctx) {
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	struct stat st;
+	if (fstat(fd, &st) == 0 and static_cast<size_t>(st.st_size) < size) {
+		char* buf = (char*)malloc(st.st_size + 1);
+		if (buf == NULL) {
+			return ENOMEM;
+		}
+		ssize_t len = read_full(fd, buf, st.st_size + 1);
+		int err = (len < 0) ? errno : write_all(fs, f, buf, len);
+		free(buf);
+		if (err == 0 and hook != NULL) {
+			hook(len, ctx);
+		}
+		return err;
+	}
+
+	BUFFER_RING ring(size, depth);
+	if (ring.status() != 0) {
+		return ring.status();
+	}
+	pipe_reader reader;
+	reader.fd = fd;
+	reader.ring = &ring;
+	reader.err = 0;
+	pthread_t thread;
+	int ret = pthread_create(&thread, NULL, pipe_read, &reader);
+	if (ret != 0) {
+		return ret;
+	}
+
+	int err = 0;
+	char* buf = NULL;
+	size_t len = 0;
+	while ((buf = ring.next_full(&len)) != NULL and len > 0) {
+		err = write_all(fs, f, buf, len);
+		ring.done();
+		if (err != 0) {
+			ring.close();
+			break;
+		}
+		if (hook != NULL) {
+			hook(len, ctx);
+		}
+	}
+	pthread_join(thread, NULL);
+	return (err != 0) ? err : reader.err;
 }
 
 int HDFS_FILE::put(const char* src, const char* dst) {
-	check(src != NULL and dst != NULL and this->connection != NULL);
+	METRIC_SCOPE m(METRIC_PUT);
+	check(src != NULL and dst != NULL);
 	check(strcmp(src, dst) != 0);
 
 	std::string dest = remove_double_slash(add_schema(dst));
@@ -419,24 +796,29 @@ int HDFS_FILE::put(const char* src, const char* dst) {
 		dest = dest.substr(0, dest.size()-1);
 	}
 
-	if(exist(dest.c_str()) == true) {
-		hdfsFileInfo * f_info = hdfsGetPathInfo(this->connection, dest.c_str());
+	bool existed = exist(dest.c_str());
+	CONN_LEASE conn(&this->pool);
+	if (conn.fs == NULL) {
+		return errno;
+	}
+
+	if(existed == true) {
+		hdfsFileInfo * f_info = cached_stat(&this->cache, conn.fs, dest.c_str());
 		if (f_info != NULL and f_info->mKind == kObjectKindDirectory) {
 			hdfsFreeFileInfo(f_info, 1);
 			dest += "/";
 			dest += std::string(basename(const_cast<char*>(src)));
 
-			int cnt = 0;
-			hdfsFileInfo* fs = hdfsListDirectory(this->connection, dest.c_str(), &cnt);
-			for (int i = 0; i < cnt; i++) {
-				if (strcmp(fs[i].mName, dest.c_str()) == 0) {
-					error("%s:%s\n", dest.c_str(), "File Existed !");
-					return -1;
-				}
+			f_info = cached_stat(&this->cache, conn.fs, dest.c_str());
+			if (f_info != NULL) {
+				hdfsFreeFileInfo(f_info, 1);
+				error("%s:%s\n", dest.c_str(), "File Existed !");
+				return -1;
 			}
-			hdfsFreeFileInfo(fs, cnt);
-
 		} else {
+			if (f_info != NULL) {
+				hdfsFreeFileInfo(f_info, 1);
+			}
 			error("%s:%s\n", dest.c_str(), "File Existed !");
 			return -1;
 		}
@@ -447,63 +829,378 @@ int HDFS_FILE::put(const char* src, const char* dst) {
 		return errno;
 	}
 
-	hdfsFile f = hdfsOpenFile(this->connection, dest.c_str(), O_WRONLY, 0, 0, 0);
+	hdfsFile f = timed_hdfsOpenFile(conn.fs, dest.c_str(), O_WRONLY, 0, 0, 0);
+	this->cache.invalidate(dest);
 	if (f == NULL) {
 		error("%s:%s\n", dst, strerror(errno));
+		conn.result(-1);
 		return errno;
 	}
 
-	FILE* local_f = fopen(src, "rb");
-	if (local_f == NULL) {
-		error("%s:%s\n", src, strerror(errno));
-		return errno;
+	int fd = ::open(src, O_RDONLY);
+	if (fd < 0) {
+		int err = errno;
+		error("%s:%s\n", src, strerror(err));
+		timed_hdfsCloseFile(conn.fs, f);
+		return err;
 	}
 
-	char buffer[20480];
-	while (!feof(local_f)) {
-		size_t cnt = fread(buffer, 1, sizeof(buffer), local_f);
-		tSize nwrite = hdfsWrite(this->connection, f, buffer, cnt);
-		if (nwrite == -1) {
-			error("%s:%s\n", dest.c_str(), strerror(errno));
-			fclose(local_f);
-			hdfsCloseFile(this->connection, f);
-			return errno;
+	int err = copy_to_hdfs(conn.fs, f, fd, this->put_buffer, this->put_depth, NULL, NULL);
+	::close(fd);
+	if (timed_hdfsCloseFile(conn.fs, f) != 0 and err == 0) {
+		err = errno;
+	}
+	if (err != 0) {
+		error("%s:%s\n", dest.c_str(), strerror(err));
+		if (err == EIO) {
+			conn.fail();
 		}
 	}
 
-	fclose(local_f);
-	hdfsCloseFile(this->connection, f);
-
-	return 0;
+	return err;
 }
 
-int HDFS_FILE::putf(const char* src, const char* dst) {
-	check(src != NULL and dst != NULL and this->connection != NULL);
-	check(strcmp(src, dst) != 0);
+static int64_t now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
 
-	std::string dest = remove_double_slash(add_schema(dst));
-	if (dest[dest.size()-1] == '/') {
-		dest = dest.substr(0, dest.size()-1);
+/* put_many() and put_tree() upload every file as a task of its own */
+struct put_state {
+	put_callback cb;
+	void* ctx;
+	size_t files_done;
+	size_t files_total;
+	int64_t bytes_done;
+	int64_t bytes_total;
+	int64_t start;
+	int64_t next_report;
+	size_t buffer_size;
+	int depth;
+	pthread_mutex_t lock;
+};
+
+struct put_job {
+	put_state* state;
+	const char* src;
+	const char* dest;
+	int* result;
+};
+
+static void put_report(put_state* s, bool last) {
+	int64_t now = now_ms();
+	int64_t due = s->next_report;
+	if (not last and (now < due or not __sync_bool_compare_and_swap(&s->next_report, due, now + PUT_PROGRESS_INTERVAL))) {
+		return;
 	}
 
-	bool is_exist = false;
-	if(exist(dest.c_str()) == true) {
-		hdfsFileInfo * f_info = hdfsGetPathInfo(this->connection, dest.c_str());
-		if (f_info != NULL and f_info->mKind == kObjectKindDirectory) {
-			hdfsFreeFileInfo(f_info, 1);
-			dest += "/";
-			dest += std::string(basename(const_cast<char*>(src)));
+	pthread_mutex_lock(&s->lock);
+	struct put_progress p;
+	p.files_done = s->files_done;
+	p.files_total = s->files_total;
+	p.bytes_done = s->bytes_done;
+	p.bytes_total = s->bytes_total;
+	p.bytes_per_sec = p.bytes_done * 1000.0 / std::max(now - s->start, static_cast<int64_t>(1));
+	if (s->cb != NULL) {
+		s->cb(&p, s->ctx);
+	} else {
+		info("put: %lu/%lu files, %lld/%lld bytes, %.1f MB/s\n", p.files_done, p.files_total,
+			(long long)p.bytes_done, (long long)p.bytes_total, p.bytes_per_sec / (1024*1024));
+	}
+	pthread_mutex_unlock(&s->lock);
+}
 
-			int cnt = 0;
-			hdfsFileInfo* fs = hdfsListDirectory(this->connection, dest.c_str(), &cnt);
-			for (int i = 0; i < cnt; i++) {
-				if (strcmp(fs[i].mName, dest.c_str()) == 0) {
-					is_exist = true;
-				}
-			}
-			hdfsFreeFileInfo(fs, cnt);
+static void put_wrote(size_t bytes, void* ctx) {
+	put_state* state = reinterpret_cast<put_state*>(ctx);
+	__sync_fetch_and_add(&state->bytes_done, static_cast<int64_t>(bytes));
+	put_report(state, false);
+}
 
+static void put_step(TASK_QUEUE* queue, hdfsFS fs, void* arg) {
+	put_job* job = reinterpret_cast<put_job*>(arg);
+	int fd = ::open(job->src, O_RDONLY);
+	if (fd < 0) {
+		*job->result = errno;
+		error("%s:%s\n", job->src, strerror(errno));
+		__sync_fetch_and_add(&job->state->files_done, 1);
+		return;
+	}
+	hdfsFile f = timed_hdfsOpenFile(fs, job->dest, O_WRONLY, 0, 0, 0);
+	if (f == NULL) {
+		*job->result = errno;
+		error("%s:%s\n", job->dest, strerror(errno));
+		::close(fd);
+		__sync_fetch_and_add(&job->state->files_done, 1);
+		return;
+	}
+
+	int err = copy_to_hdfs(fs, f, fd, job->state->buffer_size, job->state->depth, put_wrote, job->state);
+	::close(fd);
+	if (timed_hdfsCloseFile(fs, f) != 0 and err == 0) {
+		err = errno;
+	}
+	if (err != 0) {
+		error("%s:%s\n", job->dest, strerror(err));
+	}
+	*job->result = err;
+	__sync_fetch_and_add(&job->state->files_done, 1);
+}
+
+/* uploads srcs[i] to the full uri dests[i] wherever result[i] is still 0,
+ * on up to <writers> pooled connections */
+int HDFS_FILE::upload(std::vector<std::string> &srcs, std::vector<std::string> &dests, int writers,
+		std::vector<int> &result, put_callback cb, void* ctx) {
+	put_state state;
+	state.cb = cb;
+	state.ctx = ctx;
+	state.files_done = 0;
+	state.files_total = 0;
+	state.bytes_done = 0;
+	state.bytes_total = 0;
+	state.start = now_ms();
+	state.next_report = state.start + PUT_PROGRESS_INTERVAL;
+	state.buffer_size = this->put_buffer;
+	state.depth = this->put_depth;
+	pthread_mutex_init(&state.lock, NULL);
+
+	std::vector<put_job> jobs;
+	for (size_t i = 0; i < srcs.size(); i++) {
+		if (result[i] != 0) {
+			continue;
+		}
+		struct stat st;
+		if (stat(srcs[i].c_str(), &st) != 0) {
+			result[i] = errno;
+			error("%s:%s\n", srcs[i].c_str(), strerror(errno));
+			continue;
+		}
+		if (not S_ISREG(st.st_mode)) {
+			result[i] = EISDIR;
+			error("%s:%s\n", srcs[i].c_str(), "Not a regular file");
+			continue;
+		}
+		put_job job;
+		job.state = &state;
+		job.src = srcs[i].c_str();
+		job.dest = dests[i].c_str();
+		job.result = &result[i];
+		jobs.push_back(job);
+		state.bytes_total += st.st_size;
+	}
+	state.files_total = jobs.size();
+
+	int ret = 0;
+	std::vector<hdfsFS> conns;
+	if (writers <= 0) {
+		writers = this->parallelism;
+	}
+	if (jobs.size() > 0) {
+		if (this->pool.lease_many(std::min(jobs.size(), static_cast<size_t>(writers)), conns) == 0) {
+			ret = errno;
+		} else {
+			TASK_QUEUE queue(conns);
+			for (size_t i = 0; i < jobs.size(); i++) {
+				queue.push(put_step, &jobs[i]);
+			}
+			queue.run();
+			this->pool.release_many(conns);
+			put_report(&state, true);
+		}
+	}
+	for (size_t i = 0; i < dests.size(); i++) {
+		this->cache.invalidate(dests[i]);
+	}
+
+	pthread_mutex_destroy(&state.lock);
+	return ret;
+}
+
+/* names already in the hdfs directory <dir>, one listing. false if <dir> does not exist */
+static bool listed_names(META_CACHE* cache, hdfsFS fs, const std::string &dir, std::set<std::string> &names) {
+	int cnt = 0;
+	cache->invalidate(dir);
+	hdfsFileInfo* entries = cached_list(cache, fs, dir.c_str(), &cnt);
+	if (entries == NULL) {
+		return errno == 0;
+	}
+	for (int i = 0; i < cnt; i++) {
+		std::string name = entries[i].mName;
+		names.insert(name.substr(name.rfind('/') + 1));
+	}
+	hdfsFreeFileInfo(entries, cnt);
+	return true;
+}
+
+/* uploads local files into the hdfs directory <dst_dir>, created if need be,
+ * keeping their base names. existing names are found with one listing and
+ * refused with EEXIST, like put() does. result[i] is 0 or an errno for
+ * srcs[i]; up to <writers> files are written at once, 0 means parallelism. */
+int HDFS_FILE::put_many(const std::vector<std::string> &srcs, const char* dst_dir, int writers,
+		std::vector<int> &result, put_callback cb, void* ctx) {
+	METRIC_SCOPE m(METRIC_PUT_MANY);
+	check(dst_dir != NULL and strlen(dst_dir) > 0);
+
+	std::string dir = remove_double_slash(add_schema(dst_dir));
+	while (dir.size() > 1 and dir[dir.size()-1] == '/') {
+		dir = dir.substr(0, dir.size()-1);
+	}
+
+	std::set<std::string> names;
+	{
+		CONN_LEASE conn(&this->pool);
+		if (conn.fs == NULL) {
+			return errno;
+		}
+		if (not listed_names(&this->cache, conn.fs, dir, names)) {
+			if (conn.result(timed_hdfsCreateDirectory(conn.fs, dir.c_str())) != 0) {
+				error("%s:%s\n", dir.c_str(), strerror(errno));
+				return errno;
+			}
+			this->cache.invalidate(dir);
+		}
+	}
+
+	std::vector<std::string> local(srcs.begin(), srcs.end());
+	std::vector<std::string> dests(srcs.size());
+	result.assign(srcs.size(), 0);
+	for (size_t i = 0; i < srcs.size(); i++) {
+		std::string name = srcs[i].substr(srcs[i].rfind('/') + 1);
+		dests[i] = dir + "/" + name;
+		if (name.size() == 0 or not names.insert(name).second) {
+			result[i] = name.size() == 0 ? EISDIR : EEXIST;
+			error("%s:%s\n", dests[i].c_str(), "File Existed !");
+		}
+	}
+	return this->upload(local, dests, writers, result, cb, ctx);
+}
+
+/* the regular files under <dir>, recursively, and the directories on the way */
+static void walk_local(const std::string &dir, const std::string &rel,
+		std::vector<std::string> &files, std::vector<std::string> &dirs) {
+	DIR* d = opendir(dir.c_str());
+	if (d == NULL) {
+		error("%s:%s\n", dir.c_str(), strerror(errno));
+		return;
+	}
+	dirs.push_back(rel);
+	std::vector<std::string> names;
+	struct dirent* e = NULL;
+	while ((e = readdir(d)) != NULL) {
+		if (strcmp(e->d_name, ".") != 0 and strcmp(e->d_name, "..") != 0) {
+			names.push_back(e->d_name);
+		}
+	}
+	closedir(d);
+	std::sort(names.begin(), names.end());
+
+	for (size_t i = 0; i < names.size(); i++) {
+		std::string path = dir + "/" + names[i];
+		std::string sub = rel.empty() ? names[i] : rel + "/" + names[i];
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0) {
+			continue;
+		}
+		if (S_ISDIR(st.st_mode)) {
+			walk_local(path, sub, files, dirs);
+		} else if (S_ISREG(st.st_mode)) {
+			files.push_back(sub);
+		}
+	}
+}
+
+/* uploads the local directory <local_dir> into <hdfs_dir>, creating the
+ * missing directories. each hdfs directory is listed once to refuse files
+ * that already exist. <srcs> gets the local files found, <result> their
+ * status as in put_many(). */
+int HDFS_FILE::put_tree(const char* local_dir, const char* hdfs_dir, int writers,
+		std::vector<std::string> &srcs, std::vector<int> &result, put_callback cb, void* ctx) {
+	METRIC_SCOPE m(METRIC_PUT_TREE);
+	check(local_dir != NULL and hdfs_dir != NULL and strlen(hdfs_dir) > 0);
+
+	std::string root = local_dir;
+	while (root.size() > 1 and root[root.size()-1] == '/') {
+		root = root.substr(0, root.size()-1);
+	}
+	struct stat st;
+	if (stat(root.c_str(), &st) != 0 or not S_ISDIR(st.st_mode)) {
+		error("%s:%s\n", local_dir, "Not a directory");
+		return ENOTDIR;
+	}
+	std::string dir = remove_double_slash(add_schema(hdfs_dir));
+	while (dir.size() > 1 and dir[dir.size()-1] == '/') {
+		dir = dir.substr(0, dir.size()-1);
+	}
+
+	std::vector<std::string> files;
+	std::vector<std::string> dirs;
+	walk_local(root, "", files, dirs);
+
+	std::set<std::string> existing;  /* relative paths already in hdfs */
+	{
+		CONN_LEASE conn(&this->pool);
+		if (conn.fs == NULL) {
+			return errno;
+		}
+		for (size_t i = 0; i < dirs.size(); i++) {
+			std::string remote = dirs[i].empty() ? dir : dir + "/" + dirs[i];
+			std::set<std::string> names;
+			if (listed_names(&this->cache, conn.fs, remote, names)) {
+				for (std::set<std::string>::iterator it = names.begin(); it != names.end(); ++it) {
+					existing.insert(dirs[i].empty() ? *it : dirs[i] + "/" + *it);
+				}
+			} else if (conn.result(timed_hdfsCreateDirectory(conn.fs, remote.c_str())) != 0) {
+				error("%s:%s\n", remote.c_str(), strerror(errno));
+				return errno;
+			}
+		}
+	}
+
+	std::vector<std::string> dests(files.size());
+	srcs.resize(files.size());
+	result.assign(files.size(), 0);
+	for (size_t i = 0; i < files.size(); i++) {
+		srcs[i] = root + "/" + files[i];
+		dests[i] = dir + "/" + files[i];
+		if (existing.count(files[i]) > 0) {
+			result[i] = EEXIST;
+			error("%s:%s\n", dests[i].c_str(), "File Existed !");
+		}
+	}
+	return this->upload(srcs, dests, writers, result, cb, ctx);
+}
+
+int HDFS_FILE::putf(const char* src, const char* dst) {
+	METRIC_SCOPE m(METRIC_PUTF);
+	check(src != NULL and dst != NULL);
+	check(strcmp(src, dst) != 0);
+
+	std::string dest = remove_double_slash(add_schema(dst));
+	if (dest[dest.size()-1] == '/') {
+		dest = dest.substr(0, dest.size()-1);
+	}
+
+	bool is_exist = false;
+	if(exist(dest.c_str()) == true) {
+		CONN_LEASE conn(&this->pool);
+		if (conn.fs == NULL) {
+			return errno;
+		}
+		hdfsFileInfo * f_info = cached_stat(&this->cache, conn.fs, dest.c_str());
+		if (f_info != NULL and f_info->mKind == kObjectKindDirectory) {
+			hdfsFreeFileInfo(f_info, 1);
+			dest += "/";
+			dest += std::string(basename(const_cast<char*>(src)));
+
+			f_info = cached_stat(&this->cache, conn.fs, dest.c_str());
+			if (f_info != NULL) {
+				hdfsFreeFileInfo(f_info, 1);
+				is_exist = true;
+			}
 		} else {
+			if (f_info != NULL) {
+				hdfsFreeFileInfo(f_info, 1);
+			}
 			is_exist = true;
 		}
 	}
@@ -514,39 +1211,778 @@ int HDFS_FILE::putf(const char* src, const char* dst) {
 }
 
 int HDFS_FILE::rename(const char* src, const char* dst) {
+	METRIC_SCOPE m(METRIC_RENAME);
 	return this->mv(src, dst);
 }
 
 int HDFS_FILE::rm(const char* path) {
-	check(path != NULL and strlen(path) > 0 and this->connection != NULL);
+	METRIC_SCOPE m(METRIC_RM);
+	check(path != NULL and strlen(path) > 0);
 	check(strcmp(path, "/") != 0); /* weak */
 	int  recursive = 1;
-	return hdfsDelete(this->connection, path, recursive);
+	CONN_LEASE conn(&this->pool);
+	if (conn.fs == NULL) {
+		return errno;
+	}
+	int ret = conn.result(timed_hdfsDelete(conn.fs, path, recursive));
+	this->invalidate(path);
+	return ret;
 }
 
 int HDFS_FILE::mkdir(const char* path) {
-	check(path != NULL and strlen(path) > 0 and this->connection != NULL);
-	return hdfsCreateDirectory(this->connection, path);
+	METRIC_SCOPE m(METRIC_MKDIR);
+	check(path != NULL and strlen(path) > 0);
+	CONN_LEASE conn(&this->pool);
+	if (conn.fs == NULL) {
+		return errno;
+	}
+	int ret = conn.result(timed_hdfsCreateDirectory(conn.fs, path));
+	this->invalidate(path);
+	return ret;
 }
 
 hdfsFileInfo* HDFS_FILE::ls(const char* path, int* cnt) {
-	check(path != NULL and strlen(path) > 0 and this->connection != NULL);
-	return hdfsListDirectory(this->connection, path, cnt);
+	METRIC_SCOPE m(METRIC_LS);
+	check(path != NULL and strlen(path) > 0);
+	CONN_LEASE conn(&this->pool);
+	if (conn.fs == NULL) {
+		*cnt = 0;
+		return NULL;
+	}
+	return cached_list(&this->cache, conn.fs, remove_double_slash(add_schema(path)).c_str(), cnt);
 }
 
 int HDFS_FILE::chmod(const char* path, short mode) {
-	check(path != NULL and strlen(path) > 0 and this->connection != NULL);
-	return hdfsChmod(this->connection, path, mode);
+	METRIC_SCOPE m(METRIC_CHMOD);
+	check(path != NULL and strlen(path) > 0);
+	CONN_LEASE conn(&this->pool);
+	if (conn.fs == NULL) {
+		return errno;
+	}
+	int ret = conn.result(timed_hdfsChmod(conn.fs, path, mode));
+	this->invalidate(path);
+	return ret;
 }
 
 int HDFS_FILE::chown(const char* path, const char* owner, const char* group) {
-	check(path != NULL and strlen(path) > 0 and this->connection != NULL);
+	METRIC_SCOPE m(METRIC_CHOWN);
+	check(path != NULL and strlen(path) > 0);
 	check(owner != NULL and strlen(owner) > 0 and group != NULL and strlen(group) > 0);
-	return hdfsChown(this->connection, path, owner, group);
+	CONN_LEASE conn(&this->pool);
+	if (conn.fs == NULL) {
+		return errno;
+	}
+	int ret = conn.result(timed_hdfsChown(conn.fs, path, owner, group));
+	this->invalidate(path);
+	return ret;
+}
+
+/* "/", "hdfs://host:port//." and the like all name the root */
+static bool is_root(const std::string &uri) {
+	std::string path = path_of(uri);
+	for (;;) {
+		if (path.size() > 0 and path[path.size()-1] == '/') {
+			path.erase(path.size()-1);
+		} else if (path.size() > 1 and path.compare(path.size()-2, 2, "/.") == 0) {
+			path.erase(path.size()-2);
+		} else {
+			return path.empty() or path == ".";
+		}
+	}
+}
+
+struct bulk_task {
+	const bulk_args* args;
+	const char* path;
+	int* result;
+};
+
+static void bulk_step(TASK_QUEUE* queue, hdfsFS fs, void* arg) {
+	bulk_task* t = reinterpret_cast<bulk_task*>(arg);
+	const bulk_args* a = t->args;
+	int ret = -1;
+
+	errno = 0;
+	switch (a->op) {
+		case BULK_RM:
+			ret = timed_hdfsDelete(fs, t->path, 1);
+			break;
+		case BULK_CHMOD:
+			ret = timed_hdfsChmod(fs, t->path, a->mode);
+			break;
+		case BULK_CHOWN:
+			ret = timed_hdfsChown(fs, t->path, a->owner, a->group);
+			break;
+		case BULK_SETREP:
+			ret = timed_hdfsSetReplication(fs, t->path, a->replication);
+			break;
+		case BULK_UTIME:
+			ret = timed_hdfsUtime(fs, t->path, a->mtime, a->atime);
+			break;
+	}
+	*t->result = (ret == 0) ? 0 : (errno != 0 ? errno : EIO);
+}
+
+/* applies <args> to every path, patterns are expanded with glob() first. the
+ * calls run on a work-stealing queue with at most <in_flight> of them on the
+ * wire, <parallelism> if it is 0. <targets> gets what was acted on and <result>
+ * 0 or an errno for each of them: ENOENT for a pattern without matches, EPERM
+ * for a rm of the root. returns the number of failures. */
+int HDFS_FILE::bulk(const std::vector<std::string> &paths, const bulk_args &args, int in_flight,
+		std::vector<std::string> &targets, std::vector<int> &result) {
+	METRIC_SCOPE m(METRIC_BULK);
+	check(in_flight >= 0);
+	check(args.op != BULK_CHOWN or args.owner != NULL or args.group != NULL);
+
+	std::set<std::string> seen;
+	targets.clear();
+	result.clear();
+	for (size_t i = 0; i < paths.size(); i++) {
+		std::string full = remove_double_slash(add_schema(paths[i]));
+		std::vector<std::string> matches;
+		int missing = 0;
+		if (contains_wildchars(full)) {
+			this->glob(full.c_str(), matches);
+		}
+		if (matches.empty()) {
+			missing = contains_wildchars(full) ? ENOENT : 0;
+			matches.push_back(full);
+		}
+		for (size_t j = 0; j < matches.size(); j++) {
+			if (seen.insert(matches[j]).second) {
+				targets.push_back(matches[j]);
+				result.push_back(missing);
+			}
+		}
+	}
+
+	std::vector<bulk_task> tasks;
+	tasks.reserve(targets.size());
+	for (size_t i = 0; i < targets.size(); i++) {
+		if (result[i] != 0) {
+			continue;
+		}
+		if (args.op == BULK_RM and is_root(targets[i])) {
+			error("refusing to delete %s\n", targets[i].c_str());
+			result[i] = EPERM;
+			continue;
+		}
+		bulk_task t;
+		t.args = &args;
+		t.path = targets[i].c_str();
+		t.result = &result[i];
+		tasks.push_back(t);
+	}
+
+	if (tasks.size() > 0) {
+		size_t n = std::min(tasks.size(), static_cast<size_t>(in_flight > 0 ? in_flight : this->parallelism));
+		std::vector<hdfsFS> conns;
+		if (this->pool.lease_many(n, conns) == 0) {
+			int err = errno != 0 ? errno : EIO;
+			for (size_t i = 0; i < tasks.size(); i++) {
+				*tasks[i].result = err;
+			}
+		} else {
+			TASK_QUEUE queue(conns);
+			for (size_t i = 0; i < tasks.size(); i++) {
+				queue.push(bulk_step, &tasks[i]);
+			}
+			queue.run();
+			this->pool.release_many(conns);
+		}
+	}
+
+	int failed = 0;
+	for (size_t i = 0; i < targets.size(); i++) {
+		this->cache.invalidate(targets[i]);
+		failed += (result[i] != 0);
+	}
+	return failed;
+}
+
+/* du() lists every directory once, on up to <parallelism> connections of a
+ * work-stealing queue. listings are too many and too big for the cache. */
+struct du_state {
+	du_summary* summary;
+	std::vector<std::pair<std::string, int64_t> > children;
+	pthread_mutex_t lock;
+};
+
+struct du_task {
+	du_state* state;
+	std::string path;
+	int64_t* subtree;  /* bytes of the directory right under the path this one is in */
+};
+
+static int size_bucket(tOffset size) {
+	return (size <= 0) ? 0 : 64 - __builtin_clzll(static_cast<unsigned long long>(size));
+}
+
+static void du_step(TASK_QUEUE* queue, hdfsFS fs, void* arg) {
+	du_task* t = reinterpret_cast<du_task*>(arg);
+	du_state* state = t->state;
+	int cnt = 0;
+	errno = 0;
+	hdfsFileInfo* entries = timed_hdfsListDirectory(fs, t->path.c_str(), &cnt);
+	if (entries == NULL) {
+		if (errno != 0) {
+			error("%s:%s\n", t->path.c_str(), strerror(errno));
+			__sync_fetch_and_add(&state->summary->errors, 1);
+		}
+		delete t;
+		return;
+	}
+
+	if (t->subtree == NULL) { /* the path itself, its directories are ranked */
+		state->children.reserve(cnt);
+	}
+	du_summary local;
+	memset(local.histogram, 0, sizeof(local.histogram));
+	local.bytes = local.replicated_bytes = local.files = local.dirs = 0;
+	for (int i = 0; i < cnt; i++) {
+		if (entries[i].mKind == kObjectKindDirectory) {
+			local.dirs++;
+			du_task* sub = new du_task;
+			sub->state = state;
+			sub->path = entries[i].mName;
+			if (t->subtree == NULL) {
+				state->children.push_back(std::make_pair(std::string(entries[i].mName), static_cast<int64_t>(0)));
+				sub->subtree = &state->children.back().second;
+			} else {
+				sub->subtree = t->subtree;
+			}
+			queue->push(du_step, sub);
+		} else {
+			local.files++;
+			local.bytes += entries[i].mSize;
+			local.replicated_bytes += entries[i].mSize * entries[i].mReplication;
+			local.histogram[size_bucket(entries[i].mSize)]++;
+		}
+	}
+	hdfsFreeFileInfo(entries, cnt);
+	if (t->subtree != NULL) {
+		__sync_fetch_and_add(t->subtree, local.bytes);
+	}
+
+	pthread_mutex_lock(&state->lock);
+	du_summary* s = state->summary;
+	s->bytes += local.bytes;
+	s->replicated_bytes += local.replicated_bytes;
+	s->files += local.files;
+	s->dirs += local.dirs;
+	for (int i = 0; i < DU_HISTOGRAM_BUCKETS; i++) {
+		s->histogram[i] += local.histogram[i];
+	}
+	pthread_mutex_unlock(&state->lock);
+	delete t;
+}
+
+static bool heavier(const std::pair<std::string, int64_t> &a, const std::pair<std::string, int64_t> &b) {
+	return a.second > b.second or (a.second == b.second and a.first < b.first);
 }
 
+/* sizes and counts of everything under <path>, like hadoop fs -du -s and
+ * hadoop fs -count together. summary.top gets the <top_n> heaviest
+ * directories right under <path>. returns 0 or an errno for <path>. */
+int HDFS_FILE::du(const char* path, size_t top_n, du_summary &summary) {
+	METRIC_SCOPE m(METRIC_DU);
+	check(path != NULL and strlen(path) > 0);
+
+	summary.bytes = summary.replicated_bytes = summary.files = summary.dirs = summary.errors = 0;
+	memset(summary.histogram, 0, sizeof(summary.histogram));
+	summary.top.clear();
+
+	std::string full = remove_double_slash(add_schema(path));
+	hdfsFileInfo* info = NULL;
+	{
+		CONN_LEASE conn(&this->pool);
+		if (conn.fs == NULL) {
+			return errno;
+		}
+		info = timed_hdfsGetPathInfo(conn.fs, full.c_str());
+		if (info == NULL) {
+			int err = (errno != 0) ? errno : ENOENT;
+			if (err == EIO) {
+				conn.fail();
+			}
+			return err;
+		}
+	}
+	if (info->mKind != kObjectKindDirectory) {
+		summary.files = 1;
+		summary.bytes = info->mSize;
+		summary.replicated_bytes = info->mSize * info->mReplication;
+		summary.histogram[size_bucket(info->mSize)] = 1;
+		hdfsFreeFileInfo(info, 1);
+		return 0;
+	}
+	hdfsFreeFileInfo(info, 1);
+	summary.dirs = 1;
+
+	du_state state;
+	state.summary = &summary;
+	pthread_mutex_init(&state.lock, NULL);
+	std::vector<hdfsFS> conns;
+	if (this->pool.lease_many(this->parallelism, conns) == 0) {
+		pthread_mutex_destroy(&state.lock);
+		return errno;
+	}
+	TASK_QUEUE queue(conns);
+	du_task* t = new du_task;
+	t->state = &state;
+	t->path = full;
+	t->subtree = NULL;
+	queue.push(du_step, t);
+	queue.run();
+	this->pool.release_many(conns);
+	pthread_mutex_destroy(&state.lock);
+
+	std::sort(state.children.begin(), state.children.end(), heavier);
+	if (state.children.size() > top_n) {
+		state.children.resize(top_n);
+	}
+	summary.top.swap(state.children);
+	return 0;
+}
+
+/* blocks() asks for the hosts of every matching file concurrently, files
+ * right under a matching directory included. each task fills its own slot
+ * so the result keeps the sorted order of the matches. */
+struct blocks_task {
+	META_CACHE* cache;
+	std::string path;
+	std::vector<block_location> found;
+	int err;
+};
+
+static void blocks_of(hdfsFS fs, const hdfsFileInfo* info, blocks_task* t) {
+	if (info->mSize == 0) {
+		return;
+	}
+	char*** hosts = timed_hdfsGetHosts(fs, info->mName, 0, info->mSize);
+	if (hosts == NULL) {
+		error("%s:%s\n", info->mName, strerror(errno));
+		t->err = errno;
+		return;
+	}
+	tOffset block = (info->mBlockSize > 0) ? info->mBlockSize : info->mSize;
+	tOffset offset = 0;
+	for (int i = 0; hosts[i] != NULL and offset < info->mSize; i++) {
+		block_location b;
+		b.path = info->mName;
+		b.offset = offset;
+		b.length = std::min(block, info->mSize - offset);
+		for (int j = 0; hosts[i][j] != NULL; j++) {
+			b.hosts.push_back(hosts[i][j]);
+		}
+		t->found.push_back(b);
+		offset += b.length;
+	}
+	hdfsFreeHosts(hosts);
+}
+
+/* names starting with '_' or '.', like _SUCCESS, are not data */
+static bool hidden(const char* path) {
+	const char* base = strrchr(path, '/');
+	base = (base == NULL) ? path : base + 1;
+	return base[0] == '_' or base[0] == '.';
+}
+
+static void blocks_step(TASK_QUEUE* queue, hdfsFS fs, void* arg) {
+	blocks_task* t = reinterpret_cast<blocks_task*>(arg);
+	errno = 0;
+	hdfsFileInfo* info = cached_stat(t->cache, fs, t->path.c_str());
+	if (info == NULL) {
+		t->err = (errno != 0) ? errno : ENOENT;
+		return;
+	}
+	if (info->mKind == kObjectKindFile) {
+		blocks_of(fs, info, t);
+	} else {
+		int cnt = 0;
+		hdfsFileInfo* entries = cached_list(t->cache, fs, t->path.c_str(), &cnt);
+		for (int i = 0; i < cnt; i++) {
+			if (entries[i].mKind == kObjectKindFile and not hidden(entries[i].mName)) {
+				blocks_of(fs, &entries[i], t);
+			}
+		}
+		if (entries != NULL) {
+			hdfsFreeFileInfo(entries, cnt);
+		}
+	}
+	hdfsFreeFileInfo(info, 1);
+}
+
+/* the blocks of every file matching <pattern>, or right under a matching
+ * directory, in path and offset order. returns 0 or an errno, ENOENT when
+ * nothing matches. */
+int HDFS_FILE::blocks(const char* pattern, std::vector<block_location> &locations) {
+	METRIC_SCOPE m(METRIC_BLOCKS);
+	check(pattern != NULL and strlen(pattern) > 0);
+	locations.clear();
+
+	std::vector<std::string> matches;
+	this->glob(pattern, matches);
+	if (matches.empty()) {
+		return ENOENT;
+	}
+
+	std::vector<blocks_task> tasks(matches.size());
+	std::vector<hdfsFS> conns;
+	if (this->pool.lease_many(std::min(matches.size(), static_cast<size_t>(this->parallelism)), conns) == 0) {
+		return errno;
+	}
+	TASK_QUEUE queue(conns);
+	for (size_t i = 0; i < matches.size(); i++) {
+		tasks[i].cache = &this->cache;
+		tasks[i].path = matches[i];
+		tasks[i].err = 0;
+		queue.push(blocks_step, &tasks[i]);
+	}
+	queue.run();
+	this->pool.release_many(conns);
+
+	int err = 0;
+	for (size_t i = 0; i < tasks.size(); i++) {
+		locations.insert(locations.end(), tasks[i].found.begin(), tasks[i].found.end());
+		if (err == 0) {
+			err = tasks[i].err;
+		}
+	}
+	return err;
+}
+
+/* "dn1.rack2.example.com" and "dn1" are the same host to the scheduler */
+static std::string short_host(const std::string &host) {
+	return host.substr(0, host.find('.'));
+}
+
+struct pending_split {
+	file_split split;
+	std::vector<size_t> candidates;  /* workers on a host holding a replica */
+};
+
+static bool fewer_candidates(const pending_split &a, const pending_split &b) {
+	if (a.candidates.size() != b.candidates.size()) {
+		return a.candidates.size() < b.candidates.size();
+	}
+	return a.split.length > b.split.length;
+}
+
+static bool longer(const pending_split &a, const pending_split &b) {
+	return a.split.length > b.split.length;
+}
+
+static bool by_offset(const file_split &a, const file_split &b) {
+	return (a.path != b.path) ? a.path < b.path : a.offset < b.offset;
+}
+
+/* cuts the blocks of <pattern> into splits of at most <split_size> bytes, a
+ * split per block if 0, and hands them to <workers>, host names that may
+ * repeat for several workers on one host. splits go to a worker on a host
+ * holding a replica as long as that keeps it within one split of an even
+ * share of the bytes, the rest go to the least loaded workers. <assigned>
+ * follows the order of <workers>. returns 0 or an errno. */
+int HDFS_FILE::splits(const char* pattern, const std::vector<std::string> &workers, tOffset split_size,
+		std::vector<std::vector<file_split> > &assigned) {
+	METRIC_SCOPE m(METRIC_SPLITS);
+	check(workers.size() > 0 and split_size >= 0);
+	assigned.assign(workers.size(), std::vector<file_split>());
+
+	std::vector<block_location> locations;
+	int err = this->blocks(pattern, locations);
+	if (err != 0) {
+		return err;
+	}
+
+	std::map<std::string, std::vector<size_t> > on_host;
+	for (size_t i = 0; i < workers.size(); i++) {
+		on_host[short_host(workers[i])].push_back(i);
+	}
+
+	std::vector<pending_split> pending;
+	tOffset total = 0;
+	tOffset largest = 0;
+	for (size_t i = 0; i < locations.size(); i++) {
+		const block_location &b = locations[i];
+		std::vector<size_t> candidates;
+		for (size_t j = 0; j < b.hosts.size(); j++) {
+			std::map<std::string, std::vector<size_t> >::iterator it = on_host.find(short_host(b.hosts[j]));
+			if (it != on_host.end()) {
+				candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+			}
+		}
+		tOffset step = (split_size > 0) ? split_size : b.length;
+		for (tOffset off = 0; off < b.length; off += step) {
+			pending_split p;
+			p.split.path = b.path;
+			p.split.offset = b.offset + off;
+			p.split.length = std::min(step, b.length - off);
+			p.split.local = false;
+			p.candidates = candidates;
+			pending.push_back(p);
+			total += p.split.length;
+			largest = std::max(largest, p.split.length);
+		}
+	}
+
+	/* the splits with the fewest local workers pick first, they have the least choice */
+	std::sort(pending.begin(), pending.end(), fewer_candidates);
+	std::vector<tOffset> load(workers.size(), 0);
+	tOffset share = total / workers.size() + largest;
+	std::vector<pending_split> remote;
+	for (size_t i = 0; i < pending.size(); i++) {
+		pending_split &p = pending[i];
+		size_t best = workers.size();
+		for (size_t j = 0; j < p.candidates.size(); j++) {
+			size_t w = p.candidates[j];
+			if (load[w] + p.split.length <= share and (best == workers.size() or load[w] < load[best])) {
+				best = w;
+			}
+		}
+		if (best == workers.size()) {
+			remote.push_back(p);
+			continue;
+		}
+		p.split.local = true;
+		load[best] += p.split.length;
+		assigned[best].push_back(p.split);
+	}
+
+	/* what is left goes to whoever has the least to do, largest first */
+	std::sort(remote.begin(), remote.end(), longer);
+	std::set<std::pair<tOffset, size_t> > idle;
+	for (size_t i = 0; i < workers.size(); i++) {
+		idle.insert(std::make_pair(load[i], i));
+	}
+	for (size_t i = 0; i < remote.size(); i++) {
+		std::pair<tOffset, size_t> least = *idle.begin();
+		idle.erase(idle.begin());
+		size_t w = least.second;
+		file_split &split = remote[i].split;
+		split.local = std::find(remote[i].candidates.begin(), remote[i].candidates.end(), w) != remote[i].candidates.end();
+		assigned[w].push_back(split);
+		idle.insert(std::make_pair(least.first + split.length, w));
+	}
+
+	for (size_t i = 0; i < assigned.size(); i++) {
+		std::sort(assigned[i].begin(), assigned[i].end(), by_offset);
+	}
+	return 0;
+}
+
+/* walk() goes through the tree like du(), testing every entry as it is listed */
+struct walk_state {
+	const walk_filter* filter;
+	walk_callback cb;
+	void* ctx;
+	pthread_mutex_t lock;
+};
+
+struct walk_task {
+	walk_state* state;
+	std::string path;
+	int depth;  /* of the entries listed */
+};
+
+static bool walk_match(const walk_filter* f, const hdfsFileInfo* info) {
+	bool dir = (info->mKind == kObjectKindDirectory);
+	if ((f->kind == 'F' and dir) or (f->kind == 'D' and not dir)) {
+		return false;
+	}
+	if ((f->min_size >= 0 and info->mSize < f->min_size) or (f->max_size >= 0 and info->mSize > f->max_size)) {
+		return false;
+	}
+	if ((f->mtime_after > 0 and info->mLastMod <= f->mtime_after) or (f->mtime_before > 0 and info->mLastMod >= f->mtime_before)) {
+		return false;
+	}
+	if (f->name_glob != NULL) {
+		const char* base = strrchr(info->mName, '/');
+		return fnmatch(f->name_glob, base == NULL ? info->mName : base + 1, 0) == 0;
+	}
+	return true;
+}
+
+/* <info> is a match, or NULL once a directory has been listed */
+static void walk_hand(TASK_QUEUE* queue, walk_state* state, const hdfsFileInfo* info) {
+	pthread_mutex_lock(&state->lock);
+	if (not queue->stopped() and state->cb(info, state->ctx) != 0) {
+		queue->stop();
+	}
+	pthread_mutex_unlock(&state->lock);
+}
+
+static void walk_step(TASK_QUEUE* queue, hdfsFS fs, void* arg) {
+	walk_task* t = reinterpret_cast<walk_task*>(arg);
+	walk_state* state = t->state;
+	const walk_filter* f = state->filter;
+	if (queue->stopped()) {
+		delete t;
+		return;
+	}
+	int cnt = 0;
+	errno = 0;
+	hdfsFileInfo* entries = timed_hdfsListDirectory(fs, t->path.c_str(), &cnt);
+	if (entries == NULL) {
+		if (errno != 0) {
+			error("%s:%s\n", t->path.c_str(), strerror(errno));
+		}
+		walk_hand(queue, state, NULL);
+		delete t;
+		return;
+	}
+
+	for (int i = 0; i < cnt and not queue->stopped(); i++) {
+		if (walk_match(f, &entries[i])) {
+			walk_hand(queue, state, &entries[i]);
+		}
+		if (entries[i].mKind != kObjectKindDirectory or (f->max_depth > 0 and t->depth >= f->max_depth)) {
+			continue;
+		}
+		if (f->prune and f->mtime_after > 0 and entries[i].mLastMod <= f->mtime_after) {
+			continue;
+		}
+		walk_task* sub = new walk_task;
+		sub->state = state;
+		sub->path = entries[i].mName;
+		sub->depth = t->depth + 1;
+		queue->push(walk_step, sub);
+	}
+	hdfsFreeFileInfo(entries, cnt);
+	walk_hand(queue, state, NULL);
+	delete t;
+}
+
+/* hands every entry under <path> that passes <filter> to <cb>, in no
+ * particular order, listing directories concurrently on up to
+ * <parallelism> connections. with filter.prune a directory not modified
+ * after filter.mtime_after is not entered: right for trees whose files are
+ * written once, wrong where files are appended to later. returns 0 or an
+ * errno for <path>. */
+int HDFS_FILE::walk(const char* path, const walk_filter &filter, walk_callback cb, void* ctx) {
+	METRIC_SCOPE m(METRIC_WALK);
+	check(path != NULL and strlen(path) > 0 and cb != NULL);
+
+	std::vector<hdfsFS> conns;
+	if (this->pool.lease_many(this->parallelism, conns) == 0) {
+		return errno;
+	}
+	std::string full = remove_double_slash(add_schema(path));
+	hdfsFileInfo* info = timed_hdfsGetPathInfo(conns[0], full.c_str());
+	if (info == NULL) {
+		int err = (errno != 0) ? errno : ENOENT;
+		this->pool.release_many(conns);
+		return err;
+	}
+	bool dir = (info->mKind == kObjectKindDirectory);
+	hdfsFreeFileInfo(info, 1);
+	if (not dir) {
+		this->pool.release_many(conns);
+		return ENOTDIR;
+	}
+
+	walk_state state;
+	state.filter = &filter;
+	state.cb = cb;
+	state.ctx = ctx;
+	pthread_mutex_init(&state.lock, NULL);
+	TASK_QUEUE queue(conns);
+	walk_task* t = new walk_task;
+	t->state = &state;
+	t->path = full;
+	t->depth = 1;
+	queue.push(walk_step, t);
+	queue.run();
+	this->pool.release_many(conns);
+	pthread_mutex_destroy(&state.lock);
+	return 0;
+}
+
+/* getmerge copies every part in ranges of at most GETMERGE_RANGE bytes, each
+ * range straight to its offset in the local file, so parts are read
+ * concurrently while the output keeps their order. */
+struct merge_state {
+	READ_STATS* stats;
+	int fd;
+	int err;
+	pthread_mutex_t lock;
+};
+
+struct merge_range {
+	merge_state* state;
+	const char* path;
+	tOffset from;    /* offset in the part */
+	tOffset size;
+	off_t to;        /* offset in the local file */
+	bool last;       /* the range that ends the part */
+};
+
+static void merge_fail(TASK_QUEUE* queue, merge_range* r, const char* what, int err) {
+	error("%s:%s\n", r->path, what);
+	pthread_mutex_lock(&r->state->lock);
+	if (r->state->err == 0) {
+		r->state->err = err;
+	}
+	pthread_mutex_unlock(&r->state->lock);
+	queue->stop();
+}
+
+static void merge_step(TASK_QUEUE* queue, hdfsFS fs, void* arg) {
+	merge_range* r = reinterpret_cast<merge_range*>(arg);
+	hdfsFile part = timed_hdfsOpenFile(fs, r->path, O_RDONLY, 0, 0, 0);
+	if (part == NULL) {
+		merge_fail(queue, r, strerror(errno), errno);
+		return;
+	}
+	if (r->from > 0 and timed_hdfsSeek(fs, part, r->from) != 0) {
+		merge_fail(queue, r, strerror(errno), errno);
+		timed_hdfsCloseFile(fs, part);
+		return;
+	}
+
+	size_t len = (r->size < GETMERGE_BUFFER_SIZE) ? r->size : GETMERGE_BUFFER_SIZE;
+	char* buffer = (char*)malloc(len > 0 ? len : 1);
+	tOffset done = 0;
+	bool failed = false;
+	while (done < r->size and not failed and not queue->stopped()) {
+		tSize want = static_cast<tSize>(std::min(r->size - done, static_cast<tOffset>(len)));
+		tSize bytes = timed_hdfsRead(fs, part, buffer, want);
+		if (bytes <= 0) {
+			merge_fail(queue, r, bytes == 0 ? "shorter than listed" : strerror(errno), bytes == 0 ? EAGAIN : errno);
+			break;
+		}
+		for (tSize off = 0; off < bytes; ) {
+			ssize_t n = pwrite(r->state->fd, buffer + off, bytes - off, r->to + done + off);
+			if (n < 0) {
+				merge_fail(queue, r, strerror(errno), errno);
+				failed = true;
+				break;
+			}
+			off += n;
+		}
+		done += bytes;
+	}
+	/* a part that grew since it was listed would not fit in its place */
+	if (r->last and done == r->size and not failed and not queue->stopped()) {
+		char extra;
+		if (timed_hdfsRead(fs, part, &extra, 1) > 0) {
+			merge_fail(queue, r, "longer than listed", EAGAIN);
+		}
+	}
+	free(buffer);
+	r->state->stats->capture(r->path, part, r->last);  /* one file per part, however many ranges */
+	if (timed_hdfsCloseFile(fs, part) == -1) {
+		error(strerror(errno));
+	}
+}
+
+/* merges the parts under <src> into the local file <dst> in listing order.
+ * the sizes come from the one listing of <src>, so the local file is
+ * allocated up front and up to <parallelism> ranges are copied at once.
+ * returns 0, an errno, or -1 when there is nothing to merge. */
 int HDFS_FILE::getmerge(const char *src, const char *dst) {
-	check(src != NULL and dst != NULL and this->connection != NULL);
+	METRIC_SCOPE m(METRIC_GETMERGE);
+	check(src != NULL and dst != NULL);
 	check(strcmp(src, dst) != 0);
 
 	std::string source = remove_double_slash(add_schema(src));
@@ -560,72 +1996,285 @@ int HDFS_FILE::getmerge(const char *src, const char *dst) {
 		return errno;
 	}
 
-	FILE* local_f = fopen(dst, "w");
-	if (local_f == NULL) {
-		error("%s:%s\n", dst, strerror(errno));
-		return errno;
-	}
 	int part_cnt = 0;
-	char buffer[20480];
-	size_t cnt;
-	tSize bytes;
-	hdfsFile part_f;
-	bool is_exist_part = false;
-	hdfsFileInfo* fs = hdfsListDirectory(this->connection, source.c_str(), &part_cnt);
+	hdfsFileInfo* fs = NULL;
+	{
+		CONN_LEASE conn(&this->pool);
+		if (conn.fs == NULL) {
+			return errno;
+		}
+		this->cache.invalidate(source.c_str());  /* the sizes have to be current */
+		fs = cached_list(&this->cache, conn.fs, source.c_str(), &part_cnt);
+	}
 	if (part_cnt == 0) {
-		error("%s:%s\n", src, "Directory is empty !"); 
+		error("%s:%s\n", src, "Directory is empty !");
 		return -1;
 	}
-	for(int i = 0; i < part_cnt; i++) {
-		if (strcmp((source+"/_SUCCESS").c_str(), fs[i].mName) == 0) {
-			continue;
-		}
 
-		hdfsFileInfo * f_info = hdfsGetPathInfo(this->connection, fs[i].mName);
-		if (f_info != NULL and f_info->mKind == kObjectKindDirectory) {
-			hdfsFreeFileInfo(f_info, 1);
+	merge_state state;
+	state.stats = &this->read_stats;
+	state.err = 0;
+	pthread_mutex_init(&state.lock, NULL);
+	std::vector<merge_range> ranges;
+	off_t total = 0;
+	std::string success = path_of(source + "/_SUCCESS");
+	for (int i = 0; i < part_cnt; i++) {
+		if (fs[i].mKind == kObjectKindDirectory or path_of(fs[i].mName) == success) {
 			continue;
 		}
-		hdfsFreeFileInfo(f_info, 1);
-		is_exist_part = true;
-
-		part_f = hdfsOpenFile(this->connection, fs[i].mName, O_RDONLY, 0, 0, 0);
+		tOffset from = 0;
+		do {
+			merge_range r;
+			r.state = &state;
+			r.path = fs[i].mName;
+			r.from = from;
+			r.size = std::min(fs[i].mSize - from, (tOffset)GETMERGE_RANGE);
+			r.to = total + from;
+			r.last = (from + r.size == fs[i].mSize);
+			ranges.push_back(r);
+			from += r.size;
+		} while (from < fs[i].mSize);
+		total += fs[i].mSize;
+	}
+	if (ranges.size() == 0) {
+		error("%s:%s\n", src, "Not found any data to be merged in directory !");
+		hdfsFreeFileInfo(fs, part_cnt);
+		pthread_mutex_destroy(&state.lock);
+		return -1;
+	}
 
-		if (part_f == NULL) {
-			error(strerror(errno));
+	state.fd = ::open(dst, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (state.fd < 0) {
+		int err = errno;
+		error("%s:%s\n", dst, strerror(err));
+		hdfsFreeFileInfo(fs, part_cnt);
+		pthread_mutex_destroy(&state.lock);
+		return err;
+	}
+	if (total > 0 and posix_fallocate(state.fd, 0, total) != 0) {
+		if (ftruncate(state.fd, total) != 0) {
+			state.err = errno;
+			error("%s:%s\n", dst, strerror(errno));
 		}
+	}
 
-		bytes = hdfsRead(this->connection, part_f, buffer, sizeof(buffer));
-		cnt = static_cast<size_t>(bytes);
+	std::vector<hdfsFS> conns;
+	size_t workers = std::min(ranges.size(), static_cast<size_t>(this->parallelism));
+	if (state.err == 0 and this->pool.lease_many(workers, conns) == 0) {
+		state.err = errno;
+	}
+	if (state.err == 0) {
+		TASK_QUEUE queue(conns);
+		for (size_t i = 0; i < ranges.size(); i++) {
+			queue.push(merge_step, &ranges[i]);
+		}
+		queue.run();
+		this->pool.release_many(conns);
+	}
 
-		while (cnt != 0) {
+	if (::close(state.fd) != 0 and state.err == 0) {
+		state.err = errno;
+	}
+	hdfsFreeFileInfo(fs, part_cnt);
+	pthread_mutex_destroy(&state.lock);
+	return state.err;
+}
 
-			fwrite(buffer, sizeof(char), cnt, local_f);
+/* get() fetches a file one block per range, each range with its own handle
+ * and hdfsPread straight into the mapped local file. a failed range is tried
+ * again from where it stopped, on a fresh connection. */
+struct get_state {
+	const char* path;
+	CONN_POOL* pool;
+	READ_STATS* stats;
+	int fd;
+	char* map;  /* NULL when the local file could not be preallocated, pwrite then */
+	int err;
+	pthread_mutex_t lock;
+};
+
+struct get_range {
+	get_state* state;
+	tOffset from;
+	tOffset size;
+	tOffset done;
+	bool counted;    /* the file went into the read stats, retries don't count it again */
+};
+
+/* 0 once the whole range is in, an errno otherwise */
+static int get_copy(TASK_QUEUE* queue, hdfsFS fs, get_range* r) {
+	get_state* s = r->state;
+	hdfsFile f = timed_hdfsOpenFile(fs, s->path, O_RDONLY, 0, 0, 0);
+	if (f == NULL) {
+		return errno;
+	}
+	char* buffer = NULL;
+	if (s->map == NULL) {
+		buffer = (char*)malloc(std::min(r->size, (tOffset)GET_READ_SIZE));
+	}
+	int err = 0;
+	while (r->done < r->size and not queue->stopped()) {
+		tOffset pos = r->from + r->done;
+		tSize want = static_cast<tSize>(std::min(r->size - r->done, (tOffset)GET_READ_SIZE));
+		char* to = (s->map != NULL) ? s->map + pos : buffer;
+		tSize bytes = timed_hdfsPread(fs, f, pos, to, want);
+		if (bytes <= 0) {
+			err = (bytes == 0) ? EAGAIN : errno;  /* shorter than it was when stat()ed */
+			break;
+		}
+		for (tSize off = 0; s->map == NULL and off < bytes; ) {
+			ssize_t n = pwrite(s->fd, buffer + off, bytes - off, pos + off);
+			if (n < 0) {
+				err = errno;
+				break;
+			}
+			off += n;
+		}
+		if (err != 0) {
+			break;
+		}
+		r->done += bytes;
+	}
+	free(buffer);
+	s->stats->capture(s->path, f, r->from == 0 and not r->counted);
+	r->counted = true;
+	timed_hdfsCloseFile(fs, f);
+	return err;
+}
 
-			bytes = hdfsRead(this->connection, part_f, buffer, sizeof(buffer));
-			cnt = static_cast<size_t>(bytes);
+static void get_step(TASK_QUEUE* queue, hdfsFS fs, void* arg) {
+	get_range* r = reinterpret_cast<get_range*>(arg);
+	get_state* s = r->state;
+	int err = get_copy(queue, fs, r);
+	int attempt = 1;
+	while (err != 0 and err != EAGAIN and err != ENOENT and attempt < GET_RETRIES and not queue->stopped()) {
+		warn("%s: range at %lld failed (%s), retry %d\n", s->path, (long long)(r->from + r->done), strerror(err), attempt);
+		usleep((GET_RETRY_DELAY << (attempt - 1)) * 1000);
+		tOffset before = r->done;
+		hdfsFS retry = s->pool->lease_extra();
+		if (retry == NULL) {
+			err = errno;
+		} else {
+			err = get_copy(queue, retry, r);
+			s->pool->release(retry, err == EIO);
 		}
+		if (r->done == before) {
+			attempt++;  /* a retry that got further does not count */
+		}
+	}
+	if (err != 0) {
+		error("%s:%s\n", s->path, strerror(err));
+		pthread_mutex_lock(&s->lock);
+		if (s->err == 0) {
+			s->err = err;
+		}
+		pthread_mutex_unlock(&s->lock);
+		queue->stop();
+	}
+}
 
-		check(part_f != NULL);
+/* copies the hdfs file <src> to the local file <dst> on up to <streams>
+ * connections at once, <parallelism> if 0. the ranges follow the block
+ * boundaries so each one is read from a single datanode. returns 0 or an
+ * errno, EAGAIN if the file got shorter while it was copied. */
+int HDFS_FILE::get(const char* src, const char* dst, int streams) {
+	METRIC_SCOPE m(METRIC_GET);
+	check(src != NULL and dst != NULL and streams >= 0);
 
-		if (hdfsCloseFile(this->connection, part_f) == -1) {
-			error(strerror(errno));
+	std::string source = remove_double_slash(add_schema(src));
+	hdfsFileInfo* info = NULL;
+	{
+		CONN_LEASE conn(&this->pool);
+		if (conn.fs == NULL) {
+			return errno;
+		}
+		this->cache.invalidate(source);  /* the size has to be current */
+		info = cached_stat(&this->cache, conn.fs, source.c_str());
+		if (info == NULL) {
+			int err = errno != 0 ? errno : ENOENT;
+			error("%s:%s\n", src, strerror(err));
+			return err;
 		}
 	}
-	if (is_exist_part == false) {
-		error("%s:%s\n", src, "Not found any data to be merged in directory !");
-		return -1;
+	if (info->mKind == kObjectKindDirectory) {
+		error("%s:%s\n", src, "Is a directory, see getmerge()");
+		hdfsFreeFileInfo(info, 1);
+		return EISDIR;
+	}
+	tOffset size = info->mSize;
+	tOffset block = (info->mBlockSize > 0) ? info->mBlockSize : GETMERGE_RANGE;
+	hdfsFreeFileInfo(info, 1);
+
+	get_state state;
+	state.path = source.c_str();
+	state.pool = &this->pool;
+	state.stats = &this->read_stats;
+	state.map = NULL;
+	state.err = 0;
+	state.fd = ::open(dst, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (state.fd < 0) {
+		int err = errno;
+		error("%s:%s\n", dst, strerror(err));
+		return err;
+	}
+	pthread_mutex_init(&state.lock, NULL);
+
+	/* mapped only once the space is really there, a write to a hole of a
+	 * full disk would be a SIGBUS */
+	if (size > 0 and posix_fallocate(state.fd, 0, size) == 0) {
+		void* map = mmap(NULL, size, PROT_WRITE, MAP_SHARED, state.fd, 0);
+		if (map != MAP_FAILED) {
+			state.map = static_cast<char*>(map);
+		}
+	} else if (size > 0 and ftruncate(state.fd, size) != 0) {
+		state.err = errno;
+		error("%s:%s\n", dst, strerror(errno));
 	}
-	hdfsFreeFileInfo(fs, part_cnt);
-	fclose(local_f);
 
-	return 0;
+	std::vector<get_range> ranges;
+	for (tOffset from = 0; from < size; from += block) {
+		get_range r;
+		r.state = &state;
+		r.from = from;
+		r.size = std::min(size - from, block);
+		r.done = 0;
+		r.counted = false;
+		ranges.push_back(r);
+	}
+
+	std::vector<hdfsFS> conns;
+	size_t workers = std::min(ranges.size(), static_cast<size_t>(streams > 0 ? streams : this->parallelism));
+	if (state.err == 0 and workers > 0 and this->pool.lease_many(workers, conns) == 0) {
+		state.err = errno;
+	}
+	if (state.err == 0 and workers > 0) {
+		TASK_QUEUE queue(conns);
+		for (size_t i = 0; i < ranges.size(); i++) {
+			queue.push(get_step, &ranges[i]);
+		}
+		queue.run();
+		this->pool.release_many(conns);
+	}
+
+	if (state.map != NULL and munmap(state.map, size) != 0 and state.err == 0) {
+		state.err = errno;
+	}
+	if (::close(state.fd) != 0 and state.err == 0) {
+		state.err = errno;
+	}
+	pthread_mutex_destroy(&state.lock);
+	return state.err;
 }
 
 hdfsFileInfo* HDFS_FILE::dirinfo(const char* path) {
-	check(path != NULL and strlen(path) > 0 and this->connection != NULL);
+	METRIC_SCOPE m(METRIC_DIRINFO);
+	check(path != NULL and strlen(path) > 0);
 	if (exist(path)) {
-		return hdfsGetPathInfo(this->connection,remove_double_slash(add_schema(path)).c_str());
+		CONN_LEASE conn(&this->pool);
+		if (conn.fs == NULL) {
+			return NULL;
+		}
+		return cached_stat(&this->cache, conn.fs, remove_double_slash(add_schema(path)).c_str());
 	}
 	error("%s:%s\n", path, "Not Found");
 	return NULL;
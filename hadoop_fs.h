@@ -28,12 +28,102 @@ SOFTWARE.
 #include <string>
 #include <vector>
 
+#include "meta_cache.h"
+#include "conn_pool.h"
+#include "hdfs_stream.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 #include "hdfs.h"
 
+/* pooled connections one glob()/exist_many() call may list directories with */
+#define DEFAULT_PARALLELISM 8
+#define GETMERGE_RANGE (64*1024*1024)  /* parts are copied in ranges of at most this */
+#define GETMERGE_BUFFER_SIZE (4*1024*1024)
+
+#define GET_READ_SIZE (16*1024*1024)  /* get() asks hdfsPread for at most this at once */
+#define GET_RETRIES 3                 /* attempts per range before get() gives up */
+#define GET_RETRY_DELAY 200           /* ms before the first retry, doubled for each next one */
+
+#define PUT_PROGRESS_INTERVAL 1000  /* ms between two put_callback calls */
+
+#define DU_HISTOGRAM_BUCKETS 64
+
+/* what du() found under a path */
+struct du_summary {
+	int64_t bytes;
+	int64_t replicated_bytes;  /* bytes times their replication */
+	int64_t files;
+	int64_t dirs;              /* the path itself included, as hadoop fs -count does */
+	int64_t errors;            /* directories that could not be listed */
+	int64_t histogram[DU_HISTOGRAM_BUCKETS];  /* files by size, bucket k counts sizes below 2^k */
+	std::vector<std::pair<std::string, int64_t> > top;  /* heaviest directories right under the path */
+};
+
+/* one block of a file and the datanodes holding a replica of it */
+struct block_location {
+	std::string path;
+	tOffset offset;
+	tOffset length;
+	std::vector<std::string> hosts;
+};
+
+/* a byte range of a file given to one worker by splits() */
+struct file_split {
+	std::string path;
+	tOffset offset;
+	tOffset length;
+	bool local;  /* the worker runs on a datanode holding the range */
+};
+
+/* what walk() hands out, every bound is optional */
+struct walk_filter {
+	const char* name_glob;  /* fnmatch pattern on the base name, NULL for any */
+	int64_t min_size;       /* -1 for no bound */
+	int64_t max_size;       /* -1 for no bound */
+	tTime mtime_after;      /* 0 for no bound */
+	tTime mtime_before;     /* 0 for no bound */
+	char kind;              /* 'F' files only, 'D' directories only, 0 both */
+	int max_depth;          /* entries right under the path are at depth 1, 0 for no bound */
+	bool prune;             /* skip directories not modified after mtime_after */
+};
+
+/* called once per match, never concurrently. returning non-zero stops the walk.
+ * it is also called with a NULL <info> after every directory listed, so a
+ * caller waiting for matches that may never come can still stop the walk. */
+typedef int (*walk_callback)(const hdfsFileInfo* info, void* ctx);
+
+/* what bulk() does to every path */
+enum bulk_op { BULK_RM, BULK_CHMOD, BULK_CHOWN, BULK_SETREP, BULK_UTIME };
+
+struct bulk_args {
+	bulk_op op;
+	short mode;           /* BULK_CHMOD */
+	const char* owner;    /* BULK_CHOWN, NULL for no change */
+	const char* group;    /* BULK_CHOWN, NULL for no change */
+	int16_t replication;  /* BULK_SETREP */
+	tTime mtime;          /* BULK_UTIME, -1 for no change */
+	tTime atime;          /* BULK_UTIME, -1 for no change */
+};
+
+/* called once per distinct match, never concurrently */
+typedef void (*glob_callback)(const char* path, void* ctx);
+
+/* how far put_many()/put_tree() got */
+struct put_progress {
+	size_t files_done;
+	size_t files_total;
+	int64_t bytes_done;
+	int64_t bytes_total;
+	double bytes_per_sec;
+};
+
+/* called about every PUT_PROGRESS_INTERVAL and once at the end, never
+ * concurrently. without one the progress is logged. */
+typedef void (*put_callback)(const struct put_progress* progress, void* ctx);
+
 class HDFS_FILE {
 	public:
 		HDFS_FILE(const char* host, const int port);
@@ -42,15 +132,31 @@ class HDFS_FILE {
 
 		int init(const char* host, const int port);
 		int open(const char* path, const char* mode);
+		HDFS_STREAM* open_stream(const char* path, const char* mode);
 
 		size_t read(void* buf, size_t size);
+		ssize_t read_bytes(void* buf, size_t size);
 		size_t write(void* line);
+		size_t write(const void* buf, size_t size);
 		int connect(const char* host, int port);
+		int warmup(bool wait);
 		bool exist(const char* path);
+		int exist_many(const std::vector<std::string> &paths, std::vector<bool> &result);
+		size_t glob(const char* pattern, std::vector<std::string> &matches);
+		size_t glob(const char* pattern, glob_callback cb, void* ctx, size_t limit);
+		int set_parallelism(int n);
+		int set_pool_size(int n);
+		int set_read_buffer(size_t size, bool readahead);
+		int set_write_buffer(size_t size);
+		int set_put_buffers(size_t size, int depth);
 		int cp(const char* src, const char* dst);
 		int mv(const char* src, const char* dst);
 		int put(const char* src, const char* dst);
 		int putf(const char* src, const char* dst);
+		int put_many(const std::vector<std::string> &srcs, const char* dst_dir, int writers,
+				std::vector<int> &result, put_callback cb, void* ctx);
+		int put_tree(const char* local_dir, const char* hdfs_dir, int writers,
+				std::vector<std::string> &srcs, std::vector<int> &result, put_callback cb, void* ctx);
 		int rename(const char* src, const char* dst);
 		int rm(const char* path);
 		int mkdir(const char* path);
@@ -58,27 +164,46 @@ class HDFS_FILE {
 		hdfsFileInfo* dirinfo(const char* path);
 		int chmod(const char* path, short mode);
 		int chown(const char* path, const char* owner, const char* group);
+		int bulk(const std::vector<std::string> &paths, const bulk_args &args, int in_flight,
+				std::vector<std::string> &targets, std::vector<int> &result);
 		int flush();
 		int getmerge(const char *src, const char *dst);
+		int get(const char* src, const char* dst, int streams);
+		int du(const char* path, size_t top_n, du_summary &summary);
+		int walk(const char* path, const walk_filter &filter, walk_callback cb, void* ctx);
+		int blocks(const char* pattern, std::vector<block_location> &locations);
+		int splits(const char* pattern, const std::vector<std::string> &workers, tOffset split_size,
+				std::vector<std::vector<file_split> > &assigned);
 
 		char* getline();
+		char* getline(ssize_t* len);
 		void close();
+		HDFS_STREAM* file();
+
+		META_CACHE cache;
+		CONN_POOL pool;
+		READ_STATS read_stats;
 	private:
-		void hadoop_env();
 		std::string add_schema(std::string path);
-		bool match(std::vector<std::string> &fields);
+		void invalidate(const char* path);
 		int port;
+		int parallelism;
+		size_t read_buffer;
+		bool readahead;
+		size_t write_buffer;
+		size_t put_buffer;
+		int put_depth;
 		std::string host;
 
-		hdfsFile _f;
-		hdfsFS connection;
-
-		char buffered_chars();
-		char buffer[1024];
-		char *current;
-		bool eof;
+		std::string open_path(const char* path);
+		int upload(std::vector<std::string> &srcs, std::vector<std::string> &dests, int writers,
+				std::vector<int> &result, put_callback cb, void* ctx);
+		HDFS_STREAM stream;  /* the file behind open()/readline()/writeline()/close() */
 };
 
+/* "hdfs://host:port//a//b" to "hdfs://host:port/a/b" */
+std::string remove_double_slash(std::string path);
+
 
 #ifdef __cplusplus
 }
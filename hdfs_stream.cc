@@ -0,0 +1,783 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "hdfs_stream.h"
+#include "metrics.h"
+#include "log.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+HDFS_STREAM::HDFS_STREAM(CONN_POOL* pool, META_CACHE* cache, READ_STATS* stats) {
+	this->pool = pool;
+	this->cache = cache;
+	this->stats = stats;
+	this->connection = NULL;
+	this->_f = NULL;
+	this->broken = false;
+	this->buffer = NULL;
+	this->capacity = 0;
+	this->size = STREAM_BUFFER_SIZE;
+	this->max_size = DEFAULT_STREAM_BUFFER_SIZE;
+	this->sequential = false;
+	this->current = NULL;
+	this->end = NULL;
+	this->eof = false;
+	this->write_buffer = NULL;
+	this->write_capacity = 0;
+	this->write_size = DEFAULT_WRITE_BUFFER_SIZE;
+	this->unwritten = 0;
+	pthread_mutex_init(&this->mutex, NULL);
+
+	this->rz_options = NULL;
+	this->rz_buffers = 0;
+	this->rz_unsupported = false;
+
+	this->ahead_state = AHEAD_IDLE;
+	this->readahead = true;
+	this->ahead_started = false;
+	this->ahead_quit = false;
+	this->spare = NULL;
+	this->spare_capacity = 0;
+	this->ahead_size = 0;
+	this->spare_len = 0;
+	this->spare_errno = 0;
+	pthread_mutex_init(&this->ahead_mutex, NULL);
+	pthread_cond_init(&this->ahead_cond, NULL);
+}
+
+HDFS_STREAM::~HDFS_STREAM() {
+	if (this->_f != NULL) {
+		this->close();
+	}
+	free(this->buffer);
+	free(this->spare);
+	free(this->write_buffer);
+	pthread_cond_destroy(&this->ahead_cond);
+	pthread_mutex_destroy(&this->ahead_mutex);
+	pthread_mutex_destroy(&this->mutex);
+}
+
+/* <buffer_size> is what sequential reads may grow the buffer to, anything
+ * below STREAM_BUFFER_SIZE keeps it at that. <readahead> turns the
+ * readahead thread on or off. */
+void HDFS_STREAM::configure(size_t buffer_size, bool readahead) {
+	this->lock();
+	if (buffer_size < STREAM_BUFFER_SIZE) {
+		buffer_size = STREAM_BUFFER_SIZE;
+	}
+	if (buffer_size > MAX_STREAM_BUFFER_SIZE) {
+		buffer_size = MAX_STREAM_BUFFER_SIZE;
+	}
+	this->max_size = buffer_size;
+	if (this->size > buffer_size) {
+		this->size = buffer_size;
+	}
+	this->readahead = readahead;
+	this->unlock();
+}
+
+/* how many bytes of small writes are combined before they go out, 0 for
+ * none. what is buffered already is written out first. */
+void HDFS_STREAM::configure_write(size_t buffer_size) {
+	this->lock();
+	if (buffer_size > MAX_STREAM_BUFFER_SIZE) {
+		buffer_size = MAX_STREAM_BUFFER_SIZE;
+	}
+	if (this->unwritten > 0) {
+		this->write_out();
+	}
+	this->write_size = buffer_size;
+	this->unlock();
+}
+
+void HDFS_STREAM::lock() {
+	pthread_mutex_lock(&this->mutex);
+}
+
+void HDFS_STREAM::unlock() {
+	pthread_mutex_unlock(&this->mutex);
+}
+
+/* <path> is a full hdfs:// uri, <mode> is "r", "w" or "a" */
+int HDFS_STREAM::open(const char* path, const char* mode) {
+	check(path != NULL and strlen(path) > 0 and mode != NULL);
+
+	int flag = 0;
+	if (!strcmp(mode, "r")) {
+		flag = O_RDONLY;
+	} else if (!strcmp(mode, "w"))  {
+		flag = O_WRONLY;
+	} else if (!strcmp(mode, "a"))  {
+		flag = O_WRONLY | O_APPEND;
+	} else {
+		error("Unknown mode:%s", mode);
+		return EINVAL;
+	}
+
+	this->lock();
+	if (this->is_open()) {
+		this->unlock();
+		error("%s:already open\n", path);
+		return EBUSY;
+	}
+	this->connection = this->pool->lease_extra();
+	if (this->connection == NULL) {
+		this->unlock();
+		return errno;
+	}
+
+	this->_f = timed_hdfsOpenFile(this->connection, path, flag, 0, 0, 0);
+	int err = errno;
+	if (flag & O_WRONLY) {
+		this->cache->invalidate(path);
+	}
+	if (this->_f == NULL) {
+		error("%s:%s\n", path, strerror(err));
+		this->pool->release(this->connection, err == EIO);
+		this->connection = NULL;
+		this->unlock();
+		return err;
+	}
+	this->path = path;
+	this->broken = false;
+	this->current = this->buffer;
+	this->end = this->buffer;
+	this->eof = false;
+	this->unwritten = 0;
+	this->size = STREAM_BUFFER_SIZE;
+	this->sequential = false;
+	this->rz_unsupported = false;
+	this->unlock();
+
+	return 0;
+}
+
+int HDFS_STREAM::close() {
+	this->lock();
+	if (not this->is_open()) {
+		this->unlock();
+		errno = EBADF;
+		return -1;
+	}
+	check(this->rz_buffers == 0);
+	this->stop_ahead();
+	if (this->rz_options != NULL) {
+		hadoopRzOptionsFree(this->rz_options);
+		this->rz_options = NULL;
+	}
+
+	int ret = 0;
+	if (this->unwritten > 0) {
+		ret = this->write_out();
+	}
+	this->stats->capture(this->path.c_str(), this->_f, true);
+	if (timed_hdfsCloseFile(this->connection, this->_f) == -1) {
+		ret = -1;
+		error(strerror(errno));
+		this->broken = this->broken or (errno == EIO);
+	}
+	this->pool->release(this->connection, this->broken);
+
+	this->_f = NULL;
+	this->connection = NULL;
+	this->current = this->buffer;
+	this->end = this->buffer;
+	this->unlock();
+	return ret;
+}
+
+bool HDFS_STREAM::is_open() {
+	return this->_f != NULL;
+}
+
+bool HDFS_STREAM::writable() {
+	return this->_f != NULL and hdfsFileIsOpenForWrite(this->_f) == 1;
+}
+
+/* whatever is buffered is handed out before reading on. reads smaller
+ * than the buffer, or with a block read ahead, go through the buffer.
+ * the bytes read, 0 only at the end of the file, -1 with errno set. */
+ssize_t HDFS_STREAM::read_some(void* buf, size_t size) {
+	if (this->current == this->end and (size < this->size or this->ahead() != AHEAD_IDLE)) {
+		ssize_t bytes = this->fill();
+		if (bytes <= 0) {
+			return bytes;
+		}
+	}
+	size_t buffered = this->end - this->current;
+	if (buffered > 0) {
+		size_t cnt = (buffered < size) ? buffered : size;
+		memcpy(buf, this->current, cnt);
+		this->current += cnt;
+		return cnt;
+	}
+
+	tSize chunk = (size < (1U << 30)) ? size : (1U << 30);  /* tSize is 32 bits */
+	tSize bytes = timed_hdfsRead(this->connection, this->_f, buf, chunk);
+	if (bytes == -1) {
+		error(strerror(errno));
+		this->broken = (errno == EIO);
+	}
+	return bytes;
+}
+
+/* 0 both at the end of the file and on error, see read_fully() to tell them apart */
+size_t HDFS_STREAM::read(void* buf, size_t size) {
+	if (size == 0) {
+		return 0;
+	}
+	this->lock();
+	if (not this->is_open()) {
+		this->unlock();
+		errno = EBADF;
+		return 0;
+	}
+	ssize_t bytes = this->read_some(buf, size);
+	this->unlock();
+	return (bytes > 0) ? static_cast<size_t>(bytes) : 0;
+}
+
+/* reads until <size> bytes are in or hdfsRead reports the end of the file
+ * by returning 0. the bytes read, -1 with errno set on error. */
+ssize_t HDFS_STREAM::read_fully(void* buf, size_t size) {
+	this->lock();
+	if (not this->is_open()) {
+		this->unlock();
+		errno = EBADF;
+		return -1;
+	}
+	size_t total = 0;
+	while (total < size) {
+		ssize_t bytes = this->read_some(static_cast<char*>(buf) + total, size - total);
+		if (bytes < 0) {
+			this->unlock();
+			return -1;
+		}
+		if (bytes == 0) {
+			break;
+		}
+		total += bytes;
+	}
+	this->unlock();
+	return total;
+}
+
+/* positional read, neither the buffer nor the offset of the stream move */
+tSize HDFS_STREAM::pread(tOffset pos, void* buf, size_t size) {
+	this->lock();
+	if (not this->is_open()) {
+		this->unlock();
+		errno = EBADF;
+		return -1;
+	}
+	this->settle();
+	tSize bytes = timed_hdfsPread(this->connection, this->_f, pos, buf, size);
+	if (bytes == -1) {
+		error(strerror(errno));
+	}
+	this->unlock();
+	return bytes;
+}
+
+int HDFS_STREAM::seek(tOffset pos) {
+	this->lock();
+	if (not this->is_open()) {
+		this->unlock();
+		errno = EBADF;
+		return -1;
+	}
+	this->drop_ahead();  /* whatever was read ahead is of no use now */
+	int ret = timed_hdfsSeek(this->connection, this->_f, pos);
+	if (ret == -1) {
+		error(strerror(errno));
+	} else {
+		this->current = this->buffer;
+		this->end = this->buffer;
+		this->eof = false;
+		this->size = STREAM_BUFFER_SIZE;
+		this->sequential = false;
+	}
+	this->unlock();
+	return ret;
+}
+
+/* the offset seen by the caller, not the one of the underlying stream */
+tOffset HDFS_STREAM::tell() {
+	this->lock();
+	if (not this->is_open()) {
+		this->unlock();
+		errno = EBADF;
+		return -1;
+	}
+	int state = this->settle();
+	tOffset pos = timed_hdfsTell(this->connection, this->_f);
+	if (pos >= 0) {
+		pos += this->unwritten;
+		pos -= (this->end - this->current);
+		if (state == AHEAD_DONE and this->spare_len > 0) {
+			pos -= this->spare_len;
+		}
+	}
+	this->unlock();
+	return pos;
+}
+
+/* refills the whole buffer, 0 at end of file and -1 on error. takes the
+ * block read ahead if there is one, asks for the next block once reads
+ * turn out to be sequential. */
+ssize_t HDFS_STREAM::fill() {
+	check(this->connection != NULL and this->_f != NULL);
+	this->current = this->buffer;
+	this->end = this->buffer;
+	if (this->eof) {
+		return 0;
+	}
+
+	tSize bytes = 0;
+	if (this->settle() != AHEAD_IDLE) {
+		char* tmp = this->buffer;
+		this->buffer = this->spare;
+		this->spare = tmp;
+		size_t cap = this->capacity;
+		this->capacity = this->spare_capacity;
+		this->spare_capacity = cap;
+		this->drop_ahead();
+		bytes = this->spare_len;
+		errno = this->spare_errno;
+	} else {
+		if (this->sequential) {
+			this->grow();
+		}
+		if (this->capacity < this->size) {
+			free(this->buffer);
+			this->buffer = (char*)malloc(this->size);
+			this->capacity = this->size;
+		}
+		bytes = timed_hdfsRead(this->connection, this->_f, this->buffer, this->size);
+	}
+	this->current = this->buffer;
+	this->end = this->buffer;
+
+	if (bytes == -1) {
+		error(strerror(errno));
+		this->broken = (errno == EIO);
+		return -1;
+	}
+	if (bytes == 0) {
+		this->eof = true;
+		return 0;
+	}
+	this->end = this->buffer + bytes;
+	if (this->sequential and this->readahead) {
+		this->grow();  /* the block read ahead is the next refill */
+		this->ask_ahead();
+	}
+	this->sequential = true;
+	return bytes;
+}
+
+/* doubles what the next refill asks for, up to <max_size> */
+void HDFS_STREAM::grow() {
+	if (this->size < this->max_size) {
+		this->size = (this->size * 2 < this->max_size) ? this->size * 2 : this->max_size;
+	}
+}
+
+/* hands the next block to the readahead thread, starting it on first use */
+void HDFS_STREAM::ask_ahead() {
+	if (this->spare_capacity < this->size) {
+		free(this->spare);
+		this->spare = (char*)malloc(this->size);
+		this->spare_capacity = this->size;
+	}
+
+	pthread_mutex_lock(&this->ahead_mutex);
+	if (not this->ahead_started) {
+		this->ahead_quit = false;
+		if (pthread_create(&this->ahead_thread, NULL, HDFS_STREAM::ahead_main, this) != 0) {
+			error("no readahead thread:%s", strerror(errno));
+			this->readahead = false;
+			pthread_mutex_unlock(&this->ahead_mutex);
+			return;
+		}
+		this->ahead_started = true;
+	}
+	this->ahead_size = this->size;
+	this->ahead_state = AHEAD_RUNNING;
+	pthread_cond_broadcast(&this->ahead_cond);
+	pthread_mutex_unlock(&this->ahead_mutex);
+}
+
+/* <ahead_state> is shared with the readahead thread, it is only read or
+ * written under <ahead_mutex>. <spare_len> and <spare_errno> are safe to
+ * read once a call below has seen AHEAD_DONE. */
+int HDFS_STREAM::ahead() {
+	pthread_mutex_lock(&this->ahead_mutex);
+	int state = this->ahead_state;
+	pthread_mutex_unlock(&this->ahead_mutex);
+	return state;
+}
+
+/* waits for a block being read ahead, whatever it holds is kept. nothing
+ * else touches the file while the readahead thread reads. returns
+ * AHEAD_IDLE or AHEAD_DONE. */
+int HDFS_STREAM::settle() {
+	pthread_mutex_lock(&this->ahead_mutex);
+	while (this->ahead_state == AHEAD_RUNNING) {
+		pthread_cond_wait(&this->ahead_cond, &this->ahead_mutex);
+	}
+	int state = this->ahead_state;
+	pthread_mutex_unlock(&this->ahead_mutex);
+	return state;
+}
+
+/* settles and forgets the block read ahead */
+void HDFS_STREAM::drop_ahead() {
+	pthread_mutex_lock(&this->ahead_mutex);
+	while (this->ahead_state == AHEAD_RUNNING) {
+		pthread_cond_wait(&this->ahead_cond, &this->ahead_mutex);
+	}
+	this->ahead_state = AHEAD_IDLE;
+	pthread_mutex_unlock(&this->ahead_mutex);
+}
+
+void HDFS_STREAM::stop_ahead() {
+	this->drop_ahead();
+	if (not this->ahead_started) {
+		return;
+	}
+	pthread_mutex_lock(&this->ahead_mutex);
+	this->ahead_quit = true;
+	pthread_cond_broadcast(&this->ahead_cond);
+	pthread_mutex_unlock(&this->ahead_mutex);
+	pthread_join(this->ahead_thread, NULL);
+	this->ahead_started = false;
+}
+
+void* HDFS_STREAM::ahead_main(void* arg) {
+	HDFS_STREAM* self = static_cast<HDFS_STREAM*>(arg);
+	pthread_mutex_lock(&self->ahead_mutex);
+	while (true) {
+		while (self->ahead_state != AHEAD_RUNNING and not self->ahead_quit) {
+			pthread_cond_wait(&self->ahead_cond, &self->ahead_mutex);
+		}
+		if (self->ahead_quit) {
+			break;
+		}
+		pthread_mutex_unlock(&self->ahead_mutex);
+
+		tSize bytes = timed_hdfsRead(self->connection, self->_f, self->spare, self->ahead_size);
+		int err = errno;
+
+		pthread_mutex_lock(&self->ahead_mutex);
+		self->spare_len = bytes;
+		self->spare_errno = err;
+		self->ahead_state = AHEAD_DONE;
+		pthread_cond_broadcast(&self->ahead_cond);
+	}
+	pthread_mutex_unlock(&self->ahead_mutex);
+	return NULL;
+}
+
+/* must be called between lock() and unlock(). <line> points into the
+ * stream, '\n' included, and stays valid until the next call or unlock().
+ * returns its length, 0 at end of file and -1 on error. a line is found with
+ * memchr over the buffer, only lines crossing a refill are copied, into a
+ * spill buffer that is reused from line to line. */
+ssize_t HDFS_STREAM::readline(const char** line) {
+	if (not this->is_open()) {
+		*line = "";
+		errno = EBADF;
+		return -1;
+	}
+
+	if (this->current == this->end) {
+		ssize_t bytes = this->fill();
+		if (bytes <= 0) {
+			*line = this->current;
+			return bytes;
+		}
+	}
+
+	char* nl = (char*)memchr(this->current, '\n', this->end - this->current);
+	if (nl != NULL) {
+		*line = this->current;
+		ssize_t len = nl + 1 - this->current;
+		this->current = nl + 1;
+		return len;
+	}
+
+	this->spill.assign(this->current, this->end - this->current);
+	this->current = this->end;
+	while (true) {
+		ssize_t bytes = this->fill();
+		if (bytes < 0) {
+			return -1;
+		}
+		if (bytes == 0) {
+			break;
+		}
+		nl = (char*)memchr(this->current, '\n', this->end - this->current);
+		if (nl != NULL) {
+			this->spill.append(this->current, nl + 1 - this->current);
+			this->current = nl + 1;
+			break;
+		}
+		this->spill.append(this->current, this->end - this->current);
+		this->current = this->end;
+	}
+	*line = this->spill.data();
+	return this->spill.size();
+}
+
+/* moves the file back to the offset seen by the caller and empties both
+ * buffers, for reads that bypass them */
+int HDFS_STREAM::drop_buffered() {
+	int state = this->settle();
+	tOffset buffered = this->end - this->current;
+	if (state == AHEAD_DONE and this->spare_len > 0) {
+		buffered += this->spare_len;
+	}
+	this->drop_ahead();
+	this->current = this->buffer;
+	this->end = this->buffer;
+	this->sequential = false;
+	if (buffered == 0) {
+		return 0;
+	}
+	this->eof = false;
+	tOffset pos = timed_hdfsTell(this->connection, this->_f);
+	if (pos < 0 or timed_hdfsSeek(this->connection, this->_f, pos - buffered) != 0) {
+		error(strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* zero-copy read of up to <size> bytes from the current offset. where the
+ * block is local and short-circuit reads are on, the data is mmapped by
+ * the datanode client and never copied. the buffer must be handed back
+ * with release_zero() before close(); at the end of file it holds no data.
+ * returns NULL with errno EOPNOTSUPP when zero-copy is not possible here,
+ * the caller should read() instead. */
+struct hadoopRzBuffer* HDFS_STREAM::read_zero(int32_t size) {
+	this->lock();
+	if (not this->is_open()) {
+		this->unlock();
+		errno = EBADF;
+		return NULL;
+	}
+	if (size <= 0) {
+		this->unlock();
+		errno = EINVAL;
+		return NULL;
+	}
+	if (this->rz_unsupported) {
+		this->unlock();
+		errno = EOPNOTSUPP;
+		return NULL;
+	}
+	if (this->rz_options == NULL) {
+		this->rz_options = hadoopRzOptionsAlloc();
+		if (this->rz_options == NULL or hadoopRzOptionsSetSkipChecksum(this->rz_options, 1) != 0) {
+			error("no zero-copy options:%s", strerror(errno));
+			this->rz_unsupported = true;
+			this->unlock();
+			errno = EOPNOTSUPP;
+			return NULL;
+		}
+	}
+	if (this->drop_buffered() != 0) {
+		this->unlock();
+		return NULL;
+	}
+
+	struct hadoopRzBuffer* buf = timed_hadoopReadZero(this->_f, this->rz_options, size);
+	if (buf == NULL) {
+		if (errno == EOPNOTSUPP) {
+			this->rz_unsupported = true;
+		} else {
+			error(strerror(errno));
+			this->broken = (errno == EIO);
+		}
+	} else {
+		this->rz_buffers++;
+	}
+	this->unlock();
+	return buf;
+}
+
+void HDFS_STREAM::release_zero(struct hadoopRzBuffer* buf) {
+	this->lock();
+	check(this->_f != NULL and this->rz_buffers > 0);
+	hadoopRzBufferFree(this->_f, buf);
+	this->rz_buffers--;
+	this->unlock();
+}
+
+int HDFS_STREAM::zero_buffers() {
+	return this->rz_buffers;
+}
+
+/* a malloc'd copy of the next line, NUL terminated for callers that treat
+ * it as a string. <len>, if given, gets its real length, which counts NUL
+ * bytes inside the line: 0 at the end of the file, -1 on error. */
+char* HDFS_STREAM::getline(ssize_t* len) {
+	this->lock();
+	const char* line = NULL;
+	ssize_t bytes = this->readline(&line);
+	if (len != NULL) {
+		*len = bytes;
+	}
+	if (bytes < 0) {
+		bytes = 0;
+	}
+	char* copy = (char*)malloc(bytes + 1);
+	memcpy(copy, line, bytes);
+	copy[bytes] = '\0';
+	this->unlock();
+	return copy;
+}
+
+/* hdfsWrite until all of <buf> is out, 0 or -1 with errno set */
+int HDFS_STREAM::write_through(const char* buf, size_t size) {
+	while (size > 0) {
+		tSize chunk = (size < (1U << 30)) ? size : (1U << 30);  /* tSize is 32 bits */
+		tSize nwrite = timed_hdfsWrite(this->connection, this->_f, buf, chunk);
+		if (nwrite <= 0) {
+			int err = (nwrite == 0) ? EIO : errno;
+			error(strerror(err));
+			this->broken = (err == EIO);
+			errno = err;
+			return -1;
+		}
+		buf += nwrite;
+		size -= nwrite;
+	}
+	return 0;
+}
+
+/* what is combined in the buffer is dropped even if writing it fails, there
+ * is no telling how much of it made it. */
+int HDFS_STREAM::write_out() {
+	size_t size = this->unwritten;
+	this->unwritten = 0;
+	return this->write_through(this->write_buffer, size);
+}
+
+/* copies <buf> behind what is buffered, writes that out when it would
+ * overflow. writes of the buffer size and more go straight through. */
+int HDFS_STREAM::append(const char* buf, size_t size) {
+	if (this->unwritten + size > this->write_size and this->unwritten > 0) {
+		if (this->write_out() != 0) {
+			return -1;
+		}
+	}
+	if (size >= this->write_size) {
+		return this->write_through(buf, size);
+	}
+	if (this->write_capacity < this->write_size) {
+		char* grown = (char*)realloc(this->write_buffer, this->write_size);
+		if (grown == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		this->write_buffer = grown;
+		this->write_capacity = this->write_size;
+	}
+	memcpy(this->write_buffer + this->unwritten, buf, size);
+	this->unwritten += size;
+	return 0;
+}
+
+/* <size> when all of <buf> is written or combined, 0 with errno set on
+ * error, EBADF unless the file is open for writing */
+size_t HDFS_STREAM::write(const void* buf, size_t size) {
+	if (size == 0) {
+		return 0;
+	}
+
+	this->lock();
+	if (not this->writable()) {
+		this->unlock();
+		errno = EBADF;
+		return 0;
+	}
+	int ret = this->append(static_cast<const char*>(buf), size);
+	this->unlock();
+	return (ret == 0) ? size : 0;
+}
+
+/* all of <iov> under one lock, the bytes written or -1 with errno set */
+ssize_t HDFS_STREAM::write_many(const struct iovec* iov, int cnt) {
+	ssize_t total = 0;
+	this->lock();
+	if (not this->writable()) {
+		this->unlock();
+		errno = EBADF;
+		return -1;
+	}
+	for (int i = 0; i < cnt; i++) {
+		if (iov[i].iov_len == 0) {
+			continue;
+		}
+		if (this->append(static_cast<const char*>(iov[i].iov_base), iov[i].iov_len) != 0) {
+			total = -1;
+			break;
+		}
+		total += iov[i].iov_len;
+	}
+	this->unlock();
+	return total;
+}
+
+int HDFS_STREAM::flush() {
+	this->lock();
+	if (not this->writable()) {
+		this->unlock();
+		errno = EBADF;
+		return -1;
+	}
+
+	int ret = 0;
+	if (this->unwritten > 0) {
+		ret = this->write_out();
+	}
+	if (ret == 0) {
+		ret = timed_hdfsFlush(this->connection, this->_f);
+	}
+	this->unlock();
+	return ret;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,154 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DANGDANG_HDFS_STREAM
+#define DANGDANG_HDFS_STREAM
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <string>
+
+#include "conn_pool.h"
+#include "meta_cache.h"
+#include "read_stats.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hdfs.h"
+
+#define STREAM_BUFFER_SIZE (64*1024)                 /* the first refill after open() or seek() */
+#define DEFAULT_STREAM_BUFFER_SIZE (4*1024*1024)     /* what sequential reads grow it to */
+#define MAX_STREAM_BUFFER_SIZE (256*1024*1024)
+#define DEFAULT_WRITE_BUFFER_SIZE (1024*1024)        /* small writes are combined up to this */
+
+/* one open hdfs file with its own read buffer. the stream keeps a pooled
+ * connection leased from open() to close(), taking an extra one when the
+ * pool is busy, and every call takes the stream's lock, so one stream may
+ * be shared between threads. calls on a stream that is not open fail with
+ * EBADF.
+ *
+ * the read buffer starts at STREAM_BUFFER_SIZE and doubles on every refill
+ * that follows another one without a seek in between, up to the configured
+ * size. once reads are sequential a readahead thread fills a second buffer
+ * with the next block while the current one is consumed.
+ *
+ * files open for writing combine small writes in a buffer of their own, it
+ * is written out once the next write would overflow it, on flush() and on
+ * close(). writes to a file open for reading fail with EBADF. */
+class HDFS_STREAM {
+	public:
+		HDFS_STREAM(CONN_POOL* pool, META_CACHE* cache, READ_STATS* stats);
+		~HDFS_STREAM();
+
+		int open(const char* path, const char* mode);
+		int close();
+		bool is_open();
+		bool writable();
+
+		size_t read(void* buf, size_t size);
+		ssize_t read_fully(void* buf, size_t size);
+		tSize pread(tOffset pos, void* buf, size_t size);
+		int seek(tOffset pos);
+		tOffset tell();
+		char* getline(ssize_t* len);
+		ssize_t readline(const char** line);
+		struct hadoopRzBuffer* read_zero(int32_t size);
+		void release_zero(struct hadoopRzBuffer* buf);
+		int zero_buffers();
+		size_t write(const void* buf, size_t size);
+		ssize_t write_many(const struct iovec* iov, int cnt);
+		int flush();
+
+		void configure(size_t buffer_size, bool readahead);
+		void configure_write(size_t buffer_size);
+		void lock();
+		void unlock();
+	private:
+		ssize_t fill();
+		void grow();
+		ssize_t read_some(void* buf, size_t size);
+		int drop_buffered();
+		int write_through(const char* buf, size_t size);
+		int write_out();
+		int append(const char* buf, size_t size);
+		void ask_ahead();
+		int ahead();
+		int settle();
+		void drop_ahead();
+		void stop_ahead();
+		static void* ahead_main(void* arg);
+
+		CONN_POOL* pool;
+		META_CACHE* cache;
+		READ_STATS* stats;  /* gets what the file read when it is closed */
+		std::string path;
+		hdfsFS connection;
+		hdfsFile _f;
+		bool broken;
+
+		char *buffer;
+		size_t capacity;
+		size_t size;      /* what the next refill asks for */
+		size_t max_size;
+		bool sequential;  /* no seek since the last refill */
+		char *current;
+		char *end;
+		bool eof;
+		std::string spill;  /* a line that did not fit in what was left of the buffer */
+		char *write_buffer;
+		size_t write_capacity;
+		size_t write_size;  /* 0 writes straight through */
+		size_t unwritten;   /* combined in <write_buffer> and not written yet */
+		pthread_mutex_t mutex;
+
+		struct hadoopRzOptions* rz_options;
+		int rz_buffers;         /* handed out by read_zero() and not released yet */
+		bool rz_unsupported;    /* the data can not be mapped, don't ask again */
+
+		/* readahead: the thread reads <ahead_size> bytes into <spare> while
+		 * <ahead_state> is AHEAD_RUNNING, fill() swaps it in once AHEAD_DONE */
+		enum { AHEAD_IDLE, AHEAD_RUNNING, AHEAD_DONE } ahead_state;
+		bool readahead;
+		bool ahead_started;
+		bool ahead_quit;
+		char *spare;
+		size_t spare_capacity;
+		size_t ahead_size;
+		tSize spare_len;
+		int spare_errno;
+		pthread_t ahead_thread;
+		pthread_mutex_t ahead_mutex;
+		pthread_cond_t ahead_cond;
+};
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,230 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "meta_cache.h"
+#include "log.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static int64_t now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<int64_t>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* "hdfs://host:port/a/b/" and "/a/b" share the key "/a/b" */
+static std::string normalize(const std::string &path) {
+	size_t schema = path.find("://");
+	size_t root = path.find('/', schema == std::string::npos ? 0 : schema + 3);
+	std::string key = (root == std::string::npos) ? "/" : path.substr(root);
+	while (key.size() > 1 and key[key.size()-1] == '/') {
+		key = key.substr(0, key.size()-1);
+	}
+	return key;
+}
+
+static hdfsFileInfo* copy_info(const hdfsFileInfo* src, int cnt) {
+	if (src == NULL or cnt <= 0) {
+		return NULL;
+	}
+	hdfsFileInfo* dst = (hdfsFileInfo*)malloc(sizeof(hdfsFileInfo) * cnt);
+	memcpy(dst, src, sizeof(hdfsFileInfo) * cnt);
+	for (int i = 0; i < cnt; i++) {
+		dst[i].mName = src[i].mName ? strdup(src[i].mName) : NULL;
+		dst[i].mOwner = src[i].mOwner ? strdup(src[i].mOwner) : NULL;
+		dst[i].mGroup = src[i].mGroup ? strdup(src[i].mGroup) : NULL;
+	}
+	return dst;
+}
+
+META_CACHE::META_CACHE() {
+	this->capacity = DEFAULT_CACHE_CAPACITY;
+	this->ttl = DEFAULT_CACHE_TTL;
+	this->records = 0;
+	memset(&this->counters, 0, sizeof(this->counters));
+	pthread_mutex_init(&this->lock, NULL);
+}
+
+META_CACHE::~META_CACHE() {
+	this->clear();
+	pthread_mutex_destroy(&this->lock);
+}
+
+/* <capacity> 0 turns the cache off */
+void META_CACHE::configure(size_t capacity, int ttl) {
+	check(ttl >= 0);
+	pthread_mutex_lock(&this->lock);
+	this->capacity = capacity;
+	this->ttl = ttl;
+	while (this->records > this->capacity and this->lru.size() > 0) {
+		this->erase(this->index.find(this->lru.back().key));
+		this->counters.evictions++;
+	}
+	pthread_mutex_unlock(&this->lock);
+}
+
+void META_CACHE::erase(std::map<std::string, lru_list::iterator>::iterator it) {
+	entry &e = *(it->second);
+	this->records -= (e.cnt > 0) ? e.cnt : 1;
+	if (e.info != NULL) {
+		hdfsFreeFileInfo(e.info, e.cnt);
+	}
+	this->lru.erase(it->second);
+	this->index.erase(it);
+}
+
+bool META_CACHE::get(const std::string &key, hdfsFileInfo** info, int* cnt) {
+	pthread_mutex_lock(&this->lock);
+	std::map<std::string, lru_list::iterator>::iterator it = this->index.find(key);
+	if (it == this->index.end()) {
+		this->counters.misses++;
+		pthread_mutex_unlock(&this->lock);
+		return false;
+	}
+	if (it->second->expire < now_ms()) {
+		this->erase(it);
+		this->counters.misses++;
+		pthread_mutex_unlock(&this->lock);
+		return false;
+	}
+
+	this->lru.splice(this->lru.begin(), this->lru, it->second);
+	entry &e = *(it->second);
+	*info = copy_info(e.info, e.cnt);
+	*cnt = e.cnt;
+	this->counters.hits++;
+	if (e.info == NULL) {
+		this->counters.negative_hits++;
+	}
+	pthread_mutex_unlock(&this->lock);
+	return true;
+}
+
+void META_CACHE::put(const std::string &key, const hdfsFileInfo* info, int cnt) {
+	size_t weight = (cnt > 0) ? cnt : 1;
+	pthread_mutex_lock(&this->lock);
+	if (weight > this->capacity) {
+		pthread_mutex_unlock(&this->lock);
+		return;
+	}
+	std::map<std::string, lru_list::iterator>::iterator it = this->index.find(key);
+	if (it != this->index.end()) {
+		this->erase(it);
+	}
+	while (this->records + weight > this->capacity) {
+		this->erase(this->index.find(this->lru.back().key));
+		this->counters.evictions++;
+	}
+
+	entry e;
+	e.key = key;
+	e.info = copy_info(info, cnt);
+	e.cnt = (info == NULL) ? 0 : cnt;
+	e.expire = now_ms() + this->ttl;
+	this->lru.push_front(e);
+	this->index[key] = this->lru.begin();
+	this->records += weight;
+	pthread_mutex_unlock(&this->lock);
+}
+
+bool META_CACHE::get_info(const std::string &path, hdfsFileInfo** info) {
+	int cnt = 0;
+	return this->get("I" + normalize(path), info, &cnt);
+}
+
+void META_CACHE::put_info(const std::string &path, const hdfsFileInfo* info) {
+	this->put("I" + normalize(path), info, 1);
+}
+
+bool META_CACHE::get_list(const std::string &path, hdfsFileInfo** entries, int* cnt) {
+	return this->get("L" + normalize(path), entries, cnt);
+}
+
+void META_CACHE::put_list(const std::string &path, const hdfsFileInfo* entries, int cnt) {
+	this->put("L" + normalize(path), entries, cnt);
+}
+
+/* drops <key> and every key below it */
+void META_CACHE::erase_tree(const std::string &key) {
+	std::map<std::string, lru_list::iterator>::iterator it = this->index.lower_bound(key);
+	while (it != this->index.end() and it->first.compare(0, key.size(), key) == 0) {
+		if (it->first.size() == key.size() or it->first[key.size()] == '/' or key[key.size()-1] == '/') {
+			this->erase(it++);
+			this->counters.invalidations++;
+		} else {
+			++it;
+		}
+	}
+}
+
+/* a mutation of <path> changes the path itself, everything under it, and
+ * the listing and mtime of its parent. */
+void META_CACHE::invalidate(const std::string &path) {
+	std::string key = normalize(path);
+	std::string parent = key.substr(0, key.rfind('/'));
+	if (parent.empty()) {
+		parent = "/";
+	}
+
+	pthread_mutex_lock(&this->lock);
+	this->erase_tree("I" + key);
+	this->erase_tree("L" + key);
+	std::map<std::string, lru_list::iterator>::iterator it = this->index.find("I" + parent);
+	if (it != this->index.end()) {
+		this->erase(it);
+		this->counters.invalidations++;
+	}
+	it = this->index.find("L" + parent);
+	if (it != this->index.end()) {
+		this->erase(it);
+		this->counters.invalidations++;
+	}
+	pthread_mutex_unlock(&this->lock);
+}
+
+void META_CACHE::clear() {
+	pthread_mutex_lock(&this->lock);
+	while (this->index.size() > 0) {
+		this->erase(this->index.begin());
+	}
+	pthread_mutex_unlock(&this->lock);
+}
+
+void META_CACHE::stats(cache_stats* st) {
+	pthread_mutex_lock(&this->lock);
+	*st = this->counters;
+	st->entries = this->index.size();
+	st->records = this->records;
+	pthread_mutex_unlock(&this->lock);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,99 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DANGDANG_META_CACHE
+#define DANGDANG_META_CACHE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <map>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hdfs.h"
+
+#define DEFAULT_CACHE_CAPACITY 65536  /* hdfsFileInfo records, a listing costs one per entry */
+#define DEFAULT_CACHE_TTL      1000   /* milliseconds */
+
+struct cache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t negative_hits;
+	uint64_t evictions;
+	uint64_t invalidations;
+	size_t entries;
+	size_t records;
+};
+
+/* LRU of hdfsGetPathInfo and hdfsListDirectory results keyed by the path
+ * without "hdfs://host:port". a NULL result is cached as well, so a missing
+ * path is not asked for again until the entry expires. everything handed out
+ * is a private copy to be released with hdfsFreeFileInfo. */
+class META_CACHE {
+	public:
+		META_CACHE();
+		~META_CACHE();
+
+		void configure(size_t capacity, int ttl);
+		bool get_info(const std::string &path, hdfsFileInfo** info);
+		void put_info(const std::string &path, const hdfsFileInfo* info);
+		bool get_list(const std::string &path, hdfsFileInfo** entries, int* cnt);
+		void put_list(const std::string &path, const hdfsFileInfo* entries, int cnt);
+		void invalidate(const std::string &path);
+		void clear();
+		void stats(cache_stats* st);
+	private:
+		struct entry {
+			std::string key;
+			hdfsFileInfo* info;
+			int cnt;
+			int64_t expire;
+		};
+		typedef std::list<entry> lru_list;
+
+		bool get(const std::string &key, hdfsFileInfo** info, int* cnt);
+		void put(const std::string &key, const hdfsFileInfo* info, int cnt);
+		void erase(std::map<std::string, lru_list::iterator>::iterator it);
+		void erase_tree(const std::string &key);
+
+		size_t capacity;
+		int ttl;
+		size_t records;
+		lru_list lru;
+		std::map<std::string, lru_list::iterator> index;
+		cache_stats counters;
+		pthread_mutex_t lock;
+};
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,456 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "metrics.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* log-linear buckets over nanoseconds: 0..7 one by one, then every power of two
+ * split in 8, up to 2^36 (about a minute) where the last bucket takes the rest */
+#define METRIC_SUB_BITS 3
+#define METRIC_SUB (1 << METRIC_SUB_BITS)
+#define METRIC_MAX_EXP 35
+#define METRIC_BUCKETS ((METRIC_MAX_EXP - METRIC_SUB_BITS + 2) * METRIC_SUB)
+
+static const char* metric_names[] = {
+	"hdfsConnectNewInstance", "hdfsDisconnect", "hdfsExists", "hdfsOpenFile", "hdfsCloseFile",
+	"hdfsRead", "hdfsPread", "hadoopReadZero", "hdfsWrite", "hdfsFlush", "hdfsSeek", "hdfsTell",
+	"hdfsGetPathInfo", "hdfsListDirectory", "hdfsCreateDirectory", "hdfsDelete", "hdfsCopy",
+	"hdfsMove", "hdfsChmod", "hdfsChown", "hdfsSetReplication", "hdfsUtime", "hdfsGetHosts",
+	"connect", "open", "open_stream", "read", "read_bytes", "write", "getline", "flush", "close",
+	"exist", "exist_many", "glob", "cp", "mv", "put", "putf", "put_many", "put_tree", "rename",
+	"rm", "mkdir", "ls", "dirinfo", "chmod", "chown", "bulk", "getmerge", "get", "du", "walk",
+	"blocks", "splits",
+};
+typedef char metric_names_match_ops[sizeof(metric_names) / sizeof(metric_names[0]) == METRIC_OPS ? 1 : -1];
+
+/* what one thread counted. only that thread writes it; readers may see a
+ * call half counted, which is fine for metrics */
+struct metric_block {
+	uint64_t count[METRIC_OPS];
+	uint64_t errors[METRIC_OPS];
+	uint64_t bytes[METRIC_OPS];
+	uint64_t sum_ns[METRIC_OPS];
+	uint64_t* hist[METRIC_OPS];  /* METRIC_BUCKETS each, allocated by the first call of the op */
+	metric_block* prev;
+	metric_block* next;
+};
+
+volatile int metrics_enabled = 1;
+
+static pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+static metric_block* blocks = NULL;     /* of the live threads */
+static metric_block* retired = NULL;    /* what the exited threads counted */
+static metric_block* baseline = NULL;   /* the sums at the last metrics_clear() */
+static pthread_key_t block_key;
+static pthread_once_t block_key_once = PTHREAD_ONCE_INIT;
+static __thread metric_block* own = NULL;
+
+static inline int bucket_of(uint64_t ns) {
+	if (ns < METRIC_SUB) {
+		return (int)ns;
+	}
+	int exp = 63 - __builtin_clzll(ns);
+	if (exp > METRIC_MAX_EXP) {
+		return METRIC_BUCKETS - 1;
+	}
+	return (exp - METRIC_SUB_BITS + 1) * METRIC_SUB + (int)((ns >> (exp - METRIC_SUB_BITS)) & (METRIC_SUB - 1));
+}
+
+/* the largest value bucket <b> holds */
+static uint64_t bucket_top(int b) {
+	if (b < METRIC_SUB) {
+		return b;
+	}
+	int exp = b / METRIC_SUB + METRIC_SUB_BITS - 1;
+	uint64_t low = (uint64_t)(METRIC_SUB + b % METRIC_SUB) << (exp - METRIC_SUB_BITS);
+	return low + (1ULL << (exp - METRIC_SUB_BITS)) - 1;
+}
+
+static void free_block(metric_block* b) {
+	for (int op = 0; op < METRIC_OPS; op++) {
+		free(b->hist[op]);
+	}
+	free(b);
+}
+
+static void add_block(metric_block* to, const metric_block* from) {
+	for (int op = 0; op < METRIC_OPS; op++) {
+		to->count[op] += from->count[op];
+		to->errors[op] += from->errors[op];
+		to->bytes[op] += from->bytes[op];
+		to->sum_ns[op] += from->sum_ns[op];
+		const uint64_t* h = from->hist[op];
+		if (h == NULL) {
+			continue;
+		}
+		if (to->hist[op] == NULL) {
+			to->hist[op] = (uint64_t*)calloc(METRIC_BUCKETS, sizeof(uint64_t));
+			if (to->hist[op] == NULL) {
+				continue;
+			}
+		}
+		for (int b = 0; b < METRIC_BUCKETS; b++) {
+			to->hist[op][b] += h[b];
+		}
+	}
+}
+
+/* a thread is exiting: keep what it counted. this runs on that thread, so a
+ * scope ending later in its teardown starts a new block instead of writing
+ * into this one once it is freed */
+static void retire_block(void* arg) {
+	metric_block* b = (metric_block*)arg;
+	own = NULL;
+	pthread_mutex_lock(&metrics_lock);
+	if (retired == NULL) {
+		retired = (metric_block*)calloc(1, sizeof(metric_block));
+	}
+	if (retired != NULL) {
+		add_block(retired, b);
+	}
+	if (b->prev != NULL) {
+		b->prev->next = b->next;
+	} else {
+		blocks = b->next;
+	}
+	if (b->next != NULL) {
+		b->next->prev = b->prev;
+	}
+	pthread_mutex_unlock(&metrics_lock);
+	free_block(b);
+}
+
+static void make_block_key() {
+	pthread_key_create(&block_key, retire_block);
+}
+
+static metric_block* own_block() {
+	metric_block* b = (metric_block*)calloc(1, sizeof(metric_block));
+	if (b == NULL) {
+		return NULL;
+	}
+	pthread_once(&block_key_once, make_block_key);
+	pthread_mutex_lock(&metrics_lock);
+	b->next = blocks;
+	if (blocks != NULL) {
+		blocks->prev = b;
+	}
+	blocks = b;
+	pthread_mutex_unlock(&metrics_lock);
+	pthread_setspecific(block_key, b);
+	own = b;
+	return b;
+}
+
+void metric_record(int op, uint64_t ns, uint64_t bytes, bool failed) {
+	metric_block* b = own;
+	uint64_t* h = b != NULL ? b->hist[op] : NULL;
+	if (h == NULL) {
+		/* the first call of this thread or op; the caller may still look at errno */
+		int err = errno;
+		if (b == NULL) {
+			b = own_block();
+		}
+		if (b != NULL) {
+			h = (uint64_t*)calloc(METRIC_BUCKETS, sizeof(uint64_t));
+			__sync_synchronize();
+			b->hist[op] = h;
+		}
+		errno = err;
+		if (h == NULL) {
+			return;
+		}
+	}
+	b->count[op]++;
+	b->sum_ns[op] += ns;
+	b->bytes[op] += bytes;
+	if (failed) {
+		b->errors[op]++;
+	}
+	h[bucket_of(ns)]++;
+}
+
+void metrics_enable(bool on) {
+	metrics_enabled = on ? 1 : 0;
+}
+
+/* everything counted since the last metrics_clear(), NULL when out of memory */
+static metric_block* collect() {
+	metric_block* sum = (metric_block*)calloc(1, sizeof(metric_block));
+	if (sum == NULL) {
+		return NULL;
+	}
+	pthread_mutex_lock(&metrics_lock);
+	for (metric_block* b = blocks; b != NULL; b = b->next) {
+		add_block(sum, b);
+	}
+	if (retired != NULL) {
+		add_block(sum, retired);
+	}
+	if (baseline != NULL) {
+		for (int op = 0; op < METRIC_OPS; op++) {
+			sum->count[op] -= baseline->count[op];
+			sum->errors[op] -= baseline->errors[op];
+			sum->bytes[op] -= baseline->bytes[op];
+			sum->sum_ns[op] -= baseline->sum_ns[op];
+			if (sum->hist[op] != NULL and baseline->hist[op] != NULL) {
+				for (int b = 0; b < METRIC_BUCKETS; b++) {
+					sum->hist[op][b] -= baseline->hist[op][b];
+				}
+			}
+		}
+	}
+	pthread_mutex_unlock(&metrics_lock);
+	return sum;
+}
+
+/* the counters keep running, later readings just start from here */
+void metrics_clear() {
+	metric_block* now = collect();
+	if (now == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&metrics_lock);
+	if (baseline != NULL) {
+		add_block(now, baseline);
+		free_block(baseline);
+	}
+	baseline = now;
+	pthread_mutex_unlock(&metrics_lock);
+}
+
+static uint64_t percentile(const uint64_t* h, uint64_t count, double q) {
+	uint64_t rank = (uint64_t)(q * count);
+	if (rank >= count) {
+		rank = count - 1;
+	}
+	uint64_t seen = 0;
+	for (int b = 0; b < METRIC_BUCKETS; b++) {
+		seen += h[b];
+		if (seen > rank) {
+			return bucket_top(b);
+		}
+	}
+	return bucket_top(METRIC_BUCKETS - 1);
+}
+
+static const char* layer_of(int op) {
+	return op < METRIC_CONNECT ? "libhdfs" : "HDFS_FILE";
+}
+
+void metrics_snapshot(std::vector<metric_summary> &out) {
+	out.clear();
+	metric_block* sum = collect();
+	if (sum == NULL) {
+		return;
+	}
+	for (int op = 0; op < METRIC_OPS; op++) {
+		const uint64_t* h = sum->hist[op];
+		if (sum->count[op] == 0 or h == NULL) {
+			continue;
+		}
+		metric_summary s;
+		s.name = metric_names[op];
+		s.layer = layer_of(op);
+		s.count = sum->count[op];
+		s.errors = sum->errors[op];
+		s.bytes = sum->bytes[op];
+		s.sum_ns = sum->sum_ns[op];
+		s.p50_ns = percentile(h, s.count, 0.5);
+		s.p90_ns = percentile(h, s.count, 0.9);
+		s.p99_ns = percentile(h, s.count, 0.99);
+		s.p999_ns = percentile(h, s.count, 0.999);
+		s.max_ns = percentile(h, s.count, 1.0);
+		out.push_back(s);
+	}
+	free_block(sum);
+}
+
+static void append(std::string &out, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string &out, const char* fmt, ...) {
+	char line[512];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(line, sizeof(line), fmt, ap);
+	va_end(ap);
+	out += line;
+}
+
+/* the histogram buckets are exported at every 4x from 1us on, which are bucket
+ * bounds, so the cumulative counts are exact */
+void metrics_prometheus(std::string &out) {
+	out.clear();
+	metric_block* sum = collect();
+	if (sum == NULL) {
+		return;
+	}
+	out += "# HELP awesome_hdfs_call_seconds Latency of libhdfs calls and HDFS_FILE methods.\n";
+	out += "# TYPE awesome_hdfs_call_seconds histogram\n";
+	for (int op = 0; op < METRIC_OPS; op++) {
+		const uint64_t* h = sum->hist[op];
+		if (sum->count[op] == 0 or h == NULL) {
+			continue;
+		}
+		uint64_t below = 0;
+		int b = 0;
+		for (int exp = 10; exp <= METRIC_MAX_EXP; exp += 2) {
+			int edge = (exp - METRIC_SUB_BITS + 1) * METRIC_SUB;  /* the first bucket of 2^exp */
+			for (; b < edge; b++) {
+				below += h[b];
+			}
+			append(out, "awesome_hdfs_call_seconds_bucket{layer=\"%s\",op=\"%s\",le=\"%g\"} %llu\n",
+					layer_of(op), metric_names[op], (double)(1ULL << exp) / 1e9, (unsigned long long)below);
+		}
+		append(out, "awesome_hdfs_call_seconds_bucket{layer=\"%s\",op=\"%s\",le=\"+Inf\"} %llu\n",
+				layer_of(op), metric_names[op], (unsigned long long)sum->count[op]);
+		append(out, "awesome_hdfs_call_seconds_sum{layer=\"%s\",op=\"%s\"} %.9f\n",
+				layer_of(op), metric_names[op], sum->sum_ns[op] / 1e9);
+		append(out, "awesome_hdfs_call_seconds_count{layer=\"%s\",op=\"%s\"} %llu\n",
+				layer_of(op), metric_names[op], (unsigned long long)sum->count[op]);
+	}
+	out += "# HELP awesome_hdfs_call_errors_total Calls that failed.\n";
+	out += "# TYPE awesome_hdfs_call_errors_total counter\n";
+	for (int op = 0; op < METRIC_OPS; op++) {
+		if (sum->count[op] > 0) {
+			append(out, "awesome_hdfs_call_errors_total{layer=\"%s\",op=\"%s\"} %llu\n",
+					layer_of(op), metric_names[op], (unsigned long long)sum->errors[op]);
+		}
+	}
+	out += "# HELP awesome_hdfs_bytes_total Bytes read or written.\n";
+	out += "# TYPE awesome_hdfs_bytes_total counter\n";
+	for (int op = 0; op < METRIC_OPS; op++) {
+		if (sum->bytes[op] > 0) {
+			append(out, "awesome_hdfs_bytes_total{layer=\"%s\",op=\"%s\"} %llu\n",
+					layer_of(op), metric_names[op], (unsigned long long)sum->bytes[op]);
+		}
+	}
+	free_block(sum);
+}
+
+/* written aside and renamed, the scraper never sees half a file */
+static int write_prometheus(const std::string &path) {
+	std::string text;
+	metrics_prometheus(text);
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.%d", path.c_str(), (int)getpid());
+	FILE* f = fopen(tmp, "w");
+	if (f == NULL) {
+		return errno;
+	}
+	bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+	if (fclose(f) != 0) {
+		ok = false;
+	}
+	int err = ok ? 0 : (errno != 0 ? errno : EIO);
+	if (err == 0 and ::rename(tmp, path.c_str()) != 0) {
+		err = errno;
+	}
+	if (err != 0) {
+		unlink(tmp);
+	}
+	return err;
+}
+
+static pthread_mutex_t export_config = PTHREAD_MUTEX_INITIALIZER;  /* one metrics_export() at a time */
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t export_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t export_thread;
+static bool exporting = false;
+static bool export_stop = false;
+static std::string export_path;
+static int export_interval = 0;
+
+static void* export_main(void* arg) {
+	pthread_mutex_lock(&export_lock);
+	while (not export_stop) {
+		std::string path = export_path;
+		pthread_mutex_unlock(&export_lock);
+		int err = write_prometheus(path);
+		if (err != 0) {
+			warn("metrics export to %s:%s\n", path.c_str(), strerror(err));
+		}
+		pthread_mutex_lock(&export_lock);
+
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		struct timespec deadline;
+		deadline.tv_sec = now.tv_sec + export_interval;
+		deadline.tv_nsec = now.tv_usec * 1000;
+		while (not export_stop) {
+			if (pthread_cond_timedwait(&export_wake, &export_lock, &deadline) == ETIMEDOUT) {
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&export_lock);
+	return NULL;
+}
+
+int metrics_export(const char* path, int interval) {
+	pthread_mutex_lock(&export_config);
+	pthread_mutex_lock(&export_lock);
+	if (exporting) {
+		export_stop = true;
+		pthread_cond_signal(&export_wake);
+		pthread_mutex_unlock(&export_lock);
+		pthread_join(export_thread, NULL);
+		pthread_mutex_lock(&export_lock);
+		exporting = false;
+	}
+	if (path == NULL or strlen(path) == 0 or interval <= 0) {
+		pthread_mutex_unlock(&export_lock);
+		pthread_mutex_unlock(&export_config);
+		return 0;
+	}
+	export_path = path;
+	export_interval = interval;
+	export_stop = false;
+	int err = pthread_create(&export_thread, NULL, export_main, NULL);
+	if (err != 0) {
+		error("pthread_create:%s\n", strerror(err));
+	} else {
+		exporting = true;
+	}
+	pthread_mutex_unlock(&export_lock);
+	pthread_mutex_unlock(&export_config);
+	return err;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,383 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DANGDANG_METRICS
+#define DANGDANG_METRICS
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hdfs.h"
+
+/* every libhdfs call and HDFS_FILE method that is timed, see metric_names in metrics.cc */
+enum metric_op {
+	METRIC_HDFS_CONNECT,
+	METRIC_HDFS_DISCONNECT,
+	METRIC_HDFS_EXISTS,
+	METRIC_HDFS_OPEN_FILE,
+	METRIC_HDFS_CLOSE_FILE,
+	METRIC_HDFS_READ,
+	METRIC_HDFS_PREAD,
+	METRIC_HDFS_READ_ZERO,
+	METRIC_HDFS_WRITE,
+	METRIC_HDFS_FLUSH,
+	METRIC_HDFS_SEEK,
+	METRIC_HDFS_TELL,
+	METRIC_HDFS_GET_PATH_INFO,
+	METRIC_HDFS_LIST_DIRECTORY,
+	METRIC_HDFS_CREATE_DIRECTORY,
+	METRIC_HDFS_DELETE,
+	METRIC_HDFS_COPY,
+	METRIC_HDFS_MOVE,
+	METRIC_HDFS_CHMOD,
+	METRIC_HDFS_CHOWN,
+	METRIC_HDFS_SET_REPLICATION,
+	METRIC_HDFS_UTIME,
+	METRIC_HDFS_GET_HOSTS,
+	METRIC_CONNECT,  /* HDFS_FILE methods from here on */
+	METRIC_OPEN,
+	METRIC_OPEN_STREAM,
+	METRIC_READ,
+	METRIC_READ_BYTES,
+	METRIC_WRITE,
+	METRIC_GETLINE,
+	METRIC_FLUSH,
+	METRIC_CLOSE,
+	METRIC_EXIST,
+	METRIC_EXIST_MANY,
+	METRIC_GLOB,
+	METRIC_CP,
+	METRIC_MV,
+	METRIC_PUT,
+	METRIC_PUTF,
+	METRIC_PUT_MANY,
+	METRIC_PUT_TREE,
+	METRIC_RENAME,
+	METRIC_RM,
+	METRIC_MKDIR,
+	METRIC_LS,
+	METRIC_DIRINFO,
+	METRIC_CHMOD,
+	METRIC_CHOWN,
+	METRIC_BULK,
+	METRIC_GETMERGE,
+	METRIC_GET,
+	METRIC_DU,
+	METRIC_WALK,
+	METRIC_BLOCKS,
+	METRIC_SPLITS,
+	METRIC_OPS
+};
+
+struct metric_summary {
+	const char* name;
+	const char* layer;  /* "libhdfs" or "HDFS_FILE" */
+	uint64_t count;
+	uint64_t errors;
+	uint64_t bytes;
+	uint64_t sum_ns;
+	uint64_t p50_ns;    /* the percentiles and max are bucket bounds, within 1/8 of the real value */
+	uint64_t p90_ns;
+	uint64_t p99_ns;
+	uint64_t p999_ns;
+	uint64_t max_ns;
+};
+
+extern volatile int metrics_enabled;
+
+/* counts one call of <op> that took <ns>. it only touches a block of counters
+ * and log-linear histograms owned by the calling thread, no lock, no atomics;
+ * the readers below sum the blocks of every thread. */
+void metric_record(int op, uint64_t ns, uint64_t bytes, bool failed);
+
+void metrics_enable(bool on);
+void metrics_snapshot(std::vector<metric_summary> &out);  /* the ops called at least once */
+void metrics_prometheus(std::string &out);
+void metrics_clear();
+/* rewrites <path> in prometheus text format every <interval> seconds from a
+ * background thread, an empty path or interval <= 0 stops it. 0/errno returned. */
+int metrics_export(const char* path, int interval);
+
+static inline uint64_t metric_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* times the rest of the enclosing block as one <op> */
+class METRIC_SCOPE {
+	public:
+		METRIC_SCOPE(int op) {
+			this->op = op;
+			this->bytes = 0;
+			this->failed = false;
+			this->start = metrics_enabled ? metric_now() : 0;
+		}
+		~METRIC_SCOPE() {
+			if (this->start != 0) {
+				metric_record(this->op, metric_now() - this->start, this->bytes, this->failed);
+			}
+		}
+		void add_bytes(int64_t n) {
+			if (n > 0) {
+				this->bytes += n;
+			}
+		}
+		void fail() {
+			this->failed = true;
+		}
+	private:
+		int op;
+		uint64_t bytes;
+		bool failed;
+		uint64_t start;
+};
+
+/* the libhdfs calls the module makes, timed. a failure is what libhdfs
+ * reports as one: -1 or NULL */
+static inline hdfsFS timed_hdfsConnectNewInstance(const char* host, tPort port) {
+	METRIC_SCOPE m(METRIC_HDFS_CONNECT);
+	hdfsFS fs = hdfsConnectNewInstance(host, port);
+	if (fs == NULL) {
+		m.fail();
+	}
+	return fs;
+}
+
+static inline int timed_hdfsDisconnect(hdfsFS fs) {
+	METRIC_SCOPE m(METRIC_HDFS_DISCONNECT);
+	int ret = hdfsDisconnect(fs);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+/* a missing path is an answer, not a failure */
+static inline int timed_hdfsExists(hdfsFS fs, const char* path) {
+	METRIC_SCOPE m(METRIC_HDFS_EXISTS);
+	return hdfsExists(fs, path);
+}
+
+static inline hdfsFile timed_hdfsOpenFile(hdfsFS fs, const char* path, int flags, int buffer_size,
+		short replication, tSize block_size) {
+	METRIC_SCOPE m(METRIC_HDFS_OPEN_FILE);
+	hdfsFile f = hdfsOpenFile(fs, path, flags, buffer_size, replication, block_size);
+	if (f == NULL) {
+		m.fail();
+	}
+	return f;
+}
+
+static inline int timed_hdfsCloseFile(hdfsFS fs, hdfsFile f) {
+	METRIC_SCOPE m(METRIC_HDFS_CLOSE_FILE);
+	int ret = hdfsCloseFile(fs, f);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline tSize timed_hdfsRead(hdfsFS fs, hdfsFile f, void* buf, tSize size) {
+	METRIC_SCOPE m(METRIC_HDFS_READ);
+	tSize bytes = hdfsRead(fs, f, buf, size);
+	if (bytes < 0) {
+		m.fail();
+	}
+	m.add_bytes(bytes);
+	return bytes;
+}
+
+static inline tSize timed_hdfsPread(hdfsFS fs, hdfsFile f, tOffset pos, void* buf, tSize size) {
+	METRIC_SCOPE m(METRIC_HDFS_PREAD);
+	tSize bytes = hdfsPread(fs, f, pos, buf, size);
+	if (bytes < 0) {
+		m.fail();
+	}
+	m.add_bytes(bytes);
+	return bytes;
+}
+
+static inline struct hadoopRzBuffer* timed_hadoopReadZero(hdfsFile f, struct hadoopRzOptions* opts, int32_t size) {
+	METRIC_SCOPE m(METRIC_HDFS_READ_ZERO);
+	struct hadoopRzBuffer* buf = hadoopReadZero(f, opts, size);
+	if (buf == NULL) {
+		m.fail();
+	} else {
+		m.add_bytes(hadoopRzBufferLength(buf));
+	}
+	return buf;
+}
+
+static inline tSize timed_hdfsWrite(hdfsFS fs, hdfsFile f, const void* buf, tSize size) {
+	METRIC_SCOPE m(METRIC_HDFS_WRITE);
+	tSize bytes = hdfsWrite(fs, f, buf, size);
+	if (bytes < 0) {
+		m.fail();
+	}
+	m.add_bytes(bytes);
+	return bytes;
+}
+
+static inline int timed_hdfsFlush(hdfsFS fs, hdfsFile f) {
+	METRIC_SCOPE m(METRIC_HDFS_FLUSH);
+	int ret = hdfsFlush(fs, f);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline int timed_hdfsSeek(hdfsFS fs, hdfsFile f, tOffset pos) {
+	METRIC_SCOPE m(METRIC_HDFS_SEEK);
+	int ret = hdfsSeek(fs, f, pos);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline tOffset timed_hdfsTell(hdfsFS fs, hdfsFile f) {
+	METRIC_SCOPE m(METRIC_HDFS_TELL);
+	tOffset pos = hdfsTell(fs, f);
+	if (pos == -1) {
+		m.fail();
+	}
+	return pos;
+}
+
+static inline hdfsFileInfo* timed_hdfsGetPathInfo(hdfsFS fs, const char* path) {
+	METRIC_SCOPE m(METRIC_HDFS_GET_PATH_INFO);
+	hdfsFileInfo* info = hdfsGetPathInfo(fs, path);
+	if (info == NULL) {
+		m.fail();
+	}
+	return info;
+}
+
+/* an empty directory is NULL with errno 0 */
+static inline hdfsFileInfo* timed_hdfsListDirectory(hdfsFS fs, const char* path, int* cnt) {
+	METRIC_SCOPE m(METRIC_HDFS_LIST_DIRECTORY);
+	hdfsFileInfo* entries = hdfsListDirectory(fs, path, cnt);
+	if (entries == NULL and errno != 0) {
+		m.fail();
+	}
+	return entries;
+}
+
+static inline int timed_hdfsCreateDirectory(hdfsFS fs, const char* path) {
+	METRIC_SCOPE m(METRIC_HDFS_CREATE_DIRECTORY);
+	int ret = hdfsCreateDirectory(fs, path);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline int timed_hdfsDelete(hdfsFS fs, const char* path, int recursive) {
+	METRIC_SCOPE m(METRIC_HDFS_DELETE);
+	int ret = hdfsDelete(fs, path, recursive);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline int timed_hdfsCopy(hdfsFS src_fs, const char* src, hdfsFS dst_fs, const char* dst) {
+	METRIC_SCOPE m(METRIC_HDFS_COPY);
+	int ret = hdfsCopy(src_fs, src, dst_fs, dst);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline int timed_hdfsMove(hdfsFS src_fs, const char* src, hdfsFS dst_fs, const char* dst) {
+	METRIC_SCOPE m(METRIC_HDFS_MOVE);
+	int ret = hdfsMove(src_fs, src, dst_fs, dst);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline int timed_hdfsChmod(hdfsFS fs, const char* path, short mode) {
+	METRIC_SCOPE m(METRIC_HDFS_CHMOD);
+	int ret = hdfsChmod(fs, path, mode);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline int timed_hdfsChown(hdfsFS fs, const char* path, const char* owner, const char* group) {
+	METRIC_SCOPE m(METRIC_HDFS_CHOWN);
+	int ret = hdfsChown(fs, path, owner, group);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline int timed_hdfsSetReplication(hdfsFS fs, const char* path, int16_t replication) {
+	METRIC_SCOPE m(METRIC_HDFS_SET_REPLICATION);
+	int ret = hdfsSetReplication(fs, path, replication);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline int timed_hdfsUtime(hdfsFS fs, const char* path, tTime mtime, tTime atime) {
+	METRIC_SCOPE m(METRIC_HDFS_UTIME);
+	int ret = hdfsUtime(fs, path, mtime, atime);
+	if (ret == -1) {
+		m.fail();
+	}
+	return ret;
+}
+
+static inline char*** timed_hdfsGetHosts(hdfsFS fs, const char* path, tOffset start, tOffset length) {
+	METRIC_SCOPE m(METRIC_HDFS_GET_HOSTS);
+	char*** hosts = hdfsGetHosts(fs, path, start, length);
+	if (hosts == NULL) {
+		m.fail();
+	}
+	return hosts;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -28,7 +28,13 @@ extern "C" {
 
 #include <python2.7/Python.h>
 #include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <deque>
+#include <algorithm>
 #include "hadoop_fs.h"
+#include "metrics.h"
 #include "log.h"
 
 static HDFS_FILE hdfs;
@@ -40,38 +46,284 @@ static PyObject *open(PyObject *self, PyObject *args) {
 		return NULL;
 	}
 
-	int ok = hdfs.open(fname, mode);
+	int ok = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ok = hdfs.open(fname, mode);
+	Py_END_ALLOW_THREADS
 	return Py_BuildValue("i", ok);
 }
 
 
 
-static PyObject *readline(PyObject *self, PyObject *args) {
-	char* buff = hdfs.getline();
-	PyObject *line = NULL;
-	if (buff) {
-		line = Py_BuildValue("s", buff);
-		free(buff);
+/* the next line of <f> as a str, '' at the end of file. the line is copied
+ * straight out of the stream's buffer, which stays locked until then; the
+ * lock is always taken without the GIL, so holding it while taking the GIL
+ * back cannot deadlock. */
+static PyObject* read_line(HDFS_STREAM* f) {
+	const char* buff = NULL;
+	ssize_t len = 0;
+	Py_BEGIN_ALLOW_THREADS
+	f->lock();
+	len = f->readline(&buff);
+	Py_END_ALLOW_THREADS
+	PyObject* line = NULL;
+	if (len < 0) {
+		errno = EIO;
+		PyErr_SetFromErrno(PyExc_IOError);
 	} else {
-		line = Py_BuildValue("s", "");
+		line = PyString_FromStringAndSize(buff, len);
 	}
+	f->unlock();
 	return line;
 }
 
+static PyObject *readline(PyObject *self, PyObject *args) {
+	if (not hdfs.file()->is_open()) {
+		return Py_BuildValue("s", "");
+	}
+	return read_line(hdfs.file());
+}
+
+/* up to <max_lines> lines or until <max_bytes> have been read, 0 means no
+ * limit, as a list of str. the lines are gathered into one string with the
+ * GIL released and cut into str objects afterwards, so a whole batch costs
+ * one lock and one trip through the interpreter. */
+static PyObject* read_lines(HDFS_STREAM* f, size_t max_lines, size_t max_bytes) {
+	std::string lines;
+	std::vector<size_t> ends;
+	ssize_t len = 0;
+	Py_BEGIN_ALLOW_THREADS
+	f->lock();
+	const char* line = NULL;
+	while ((max_lines == 0 or ends.size() < max_lines) and (max_bytes == 0 or lines.size() < max_bytes)) {
+		len = f->readline(&line);
+		if (len <= 0) {
+			break;
+		}
+		lines.append(line, len);
+		ends.push_back(lines.size());
+	}
+	f->unlock();
+	Py_END_ALLOW_THREADS
+	if (len < 0 and ends.empty()) {
+		errno = EIO;
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+
+	PyObject* list = PyList_New(ends.size());
+	if (list == NULL) {
+		return NULL;
+	}
+	size_t start = 0;
+	for (size_t i = 0; i < ends.size(); i++) {
+		PyObject* str = PyString_FromStringAndSize(lines.data() + start, ends[i] - start);
+		if (str == NULL) {
+			Py_DECREF(list);
+			return NULL;
+		}
+		PyList_SET_ITEM(list, i, str);
+		start = ends[i];
+	}
+	return list;
+}
+
+static PyObject *readlines(PyObject *self, PyObject *args) {
+	Py_ssize_t max_lines = 0;
+	Py_ssize_t max_bytes = 0;
+	if (PyArg_ParseTuple(args, "|nn", &max_lines, &max_bytes) == 0) {
+		return NULL;
+	}
+	if (not hdfs.file()->is_open()) {
+		return PyList_New(0);
+	}
+	return read_lines(hdfs.file(), max_lines > 0 ? max_lines : 0, max_bytes > 0 ? max_bytes : 0);
+}
+
 
 static PyObject *writeline(PyObject *self, PyObject *args) {
-	char* line = NULL;
-	if (PyArg_ParseTuple(args, "s", &line) == 0) {
+	const char* line = NULL;
+	Py_ssize_t size = 0;
+	if (PyArg_ParseTuple(args, "s#", &line, &size) == 0) {
 		return NULL;
 	}
-	size_t nwrite = hdfs.write(line);
+	if (not hdfs.file()->writable()) {
+		return Py_BuildValue("i", 0);
+	}
+	size_t nwrite = 0;
+	Py_BEGIN_ALLOW_THREADS
+	nwrite = hdfs.write(line, size);
+	Py_END_ALLOW_THREADS
 
 	return Py_BuildValue("i", nwrite);
 }
 
+/* any buffer-protocol object, written with its length, NUL bytes included */
+static PyObject *write_bytes(PyObject *self, PyObject *args) {
+	Py_buffer data;
+	if (PyArg_ParseTuple(args, "s*", &data) == 0) {
+		return NULL;
+	}
+	if (not hdfs.file()->writable()) {
+		PyBuffer_Release(&data);
+		errno = EBADF;
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+	size_t nwrite = 0;
+	Py_BEGIN_ALLOW_THREADS
+	nwrite = hdfs.write(data.buf, data.len);
+	Py_END_ALLOW_THREADS
+	Py_ssize_t size = data.len;
+	PyBuffer_Release(&data);
+	if (nwrite != static_cast<size_t>(size)) {
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+	return Py_BuildValue("n", size);
+}
+
+/* <size> bytes of the open()ed file as a str, fewer only at its end */
+static PyObject *read_bytes(PyObject *self, PyObject *args) {
+	Py_ssize_t size = 0;
+	if (PyArg_ParseTuple(args, "n", &size) == 0) {
+		return NULL;
+	}
+	if (size < 0) {
+		PyErr_SetString(PyExc_ValueError, "size must not be negative");
+		return NULL;
+	}
+	if (not hdfs.file()->is_open()) {
+		errno = EBADF;
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+	PyObject* str = PyString_FromStringAndSize(NULL, size);
+	if (str == NULL or size == 0) {
+		return str;
+	}
+	ssize_t cnt = 0;
+	Py_BEGIN_ALLOW_THREADS
+	cnt = hdfs.read_bytes(PyString_AS_STRING(str), size);
+	Py_END_ALLOW_THREADS
+	if (cnt < 0) {
+		Py_DECREF(str);
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+	if (cnt < size) {
+		_PyString_Resize(&str, cnt);
+	}
+	return str;
+}
+
+
+#define WRITELINES_BATCH 1024  /* strings handed over per release of the GIL */
+
+static void release_lines(std::vector<Py_buffer> &views, std::vector<PyObject*> &items) {
+	for (size_t i = 0; i < views.size(); i++) {
+		PyBuffer_Release(&views[i]);
+	}
+	for (size_t i = 0; i < items.size(); i++) {
+		Py_DECREF(items[i]);
+	}
+	views.clear();
+	items.clear();
+}
+
+/* writes every string or buffer <iterable> yields to <f>. their lengths are
+ * known, so they are copied into the stream's write buffer as they are,
+ * WRITELINES_BATCH of them per release of the GIL. the number of bytes
+ * written returned, NULL with an exception set on error. */
+static PyObject* write_lines(HDFS_STREAM* f, PyObject* iterable, PyObject* path) {
+	PyObject* it = PyObject_GetIter(iterable);
+	if (it == NULL) {
+		return NULL;
+	}
+	std::vector<struct iovec> iov;
+	std::vector<Py_buffer> views;
+	std::vector<PyObject*> items;
+	iov.reserve(WRITELINES_BATCH);
+	items.reserve(WRITELINES_BATCH);
+
+	Py_ssize_t total = 0;
+	bool failed = false;
+	while (not failed) {
+		PyObject* item = PyIter_Next(it);
+		if (item != NULL) {
+			struct iovec v;
+			if (PyObject_CheckBuffer(item)) {
+				Py_buffer view;
+				if (PyObject_GetBuffer(item, &view, PyBUF_SIMPLE) != 0) {
+					Py_DECREF(item);
+					failed = true;
+					break;
+				}
+				views.push_back(view);
+				v.iov_base = view.buf;
+				v.iov_len = view.len;
+			} else {
+				const char* buf = NULL;
+				Py_ssize_t len = 0;
+				if (PyArg_Parse(item, "s#", &buf, &len) == 0) {
+					Py_DECREF(item);
+					failed = true;
+					break;
+				}
+				v.iov_base = const_cast<char*>(buf);
+				v.iov_len = len;
+			}
+			items.push_back(item);
+			iov.push_back(v);
+		} else if (PyErr_Occurred()) {
+			failed = true;
+			break;
+		}
+
+		if (iov.size() == WRITELINES_BATCH or (item == NULL and iov.size() > 0)) {
+			ssize_t nwrite = 0;
+			int err = 0;
+			Py_BEGIN_ALLOW_THREADS
+			nwrite = f->write_many(&iov[0], iov.size());
+			err = errno;
+			Py_END_ALLOW_THREADS
+			release_lines(views, items);
+			iov.clear();
+			if (nwrite < 0) {
+				errno = (err != 0) ? err : EIO;
+				if (path != NULL) {
+					PyErr_SetFromErrnoWithFilenameObject(PyExc_IOError, path);
+				} else {
+					PyErr_SetFromErrno(PyExc_IOError);
+				}
+				failed = true;
+				break;
+			}
+			total += nwrite;
+		}
+		if (item == NULL) {
+			break;
+		}
+	}
+	release_lines(views, items);
+	Py_DECREF(it);
+	if (failed) {
+		return NULL;
+	}
+	return Py_BuildValue("n", total);
+}
+
+static PyObject *writelines(PyObject *self, PyObject *args) {
+	PyObject* lines = NULL;
+	if (PyArg_ParseTuple(args, "O", &lines) == 0) {
+		return NULL;
+	}
+	if (not hdfs.file()->writable()) {
+		errno = EBADF;
+		return PyErr_SetFromErrno(PyExc_IOError);
+	}
+	return write_lines(hdfs.file(), lines, NULL);
+}
 
 static PyObject *close(PyObject *self, PyObject *args) {
+	Py_BEGIN_ALLOW_THREADS
 	hdfs.close();
+	Py_END_ALLOW_THREADS
 	return Py_BuildValue("i", 0);
 }
 
@@ -81,7 +333,10 @@ static PyObject *ls(PyObject *self, PyObject *args) {
 		return NULL;
 	}
 	int cnt = 0;
-	hdfsFileInfo* fs = hdfs.ls(path, &cnt);
+	hdfsFileInfo* fs = NULL;
+	Py_BEGIN_ALLOW_THREADS
+	fs = hdfs.ls(path, &cnt);
+	Py_END_ALLOW_THREADS
 
 	PyObject* list = PyList_New(cnt);
 	for(int i = 0; i < cnt; i++) {
@@ -98,7 +353,32 @@ static PyObject *mv(PyObject *self, PyObject *args) {
 	if (PyArg_ParseTuple(args, "ss", &src, &dst) == 0) {
 		return NULL;
 	}
-	return Py_BuildValue("i", hdfs.mv(src, dst));
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.mv(src, dst);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
+}
+
+/* the str items of the sequence <obj>, -1 with an exception set otherwise */
+static int string_list(PyObject* obj, std::vector<std::string> &out, const char* message) {
+	PyObject* seq = PySequence_Fast(obj, message);
+	if (seq == NULL) {
+		return -1;
+	}
+	Py_ssize_t cnt = PySequence_Fast_GET_SIZE(seq);
+	out.resize(cnt);
+	for (Py_ssize_t i = 0; i < cnt; i++) {
+		PyObject* item = PySequence_Fast_GET_ITEM(seq, i);
+		char* str = PyString_AsString(item);
+		if (str == NULL) {
+			Py_DECREF(seq);
+			return -1;
+		}
+		out[i].assign(str, PyString_GET_SIZE(item));
+	}
+	Py_DECREF(seq);
+	return 0;
 }
 
 static PyObject *put(PyObject *self, PyObject *args) {
@@ -107,7 +387,97 @@ static PyObject *put(PyObject *self, PyObject *args) {
 	if (PyArg_ParseTuple(args, "ss", &src, &dst) == 0) {
 		return NULL;
 	}
-	return Py_BuildValue("i", hdfs.put(src, dst));
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.put(src, dst);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
+}
+
+/* runs on an uploading thread, <ctx> is the python callable */
+static void put_progress_cb(const struct put_progress* p, void* ctx) {
+	PyGILState_STATE gil = PyGILState_Ensure();
+	PyObject* ret = PyObject_CallFunction(reinterpret_cast<PyObject*>(ctx), (char*)"({s:k,s:k,s:L,s:L,s:d})",
+		"files_done", (unsigned long)p->files_done,
+		"files_total", (unsigned long)p->files_total,
+		"bytes_done", (PY_LONG_LONG)p->bytes_done,
+		"bytes_total", (PY_LONG_LONG)p->bytes_total,
+		"bytes_per_sec", p->bytes_per_sec);
+	if (ret == NULL) {
+		PyErr_WriteUnraisable(reinterpret_cast<PyObject*>(ctx));
+	} else {
+		Py_DECREF(ret);
+	}
+	PyGILState_Release(gil);
+}
+
+static int progress_arg(PyObject* progress) {
+	if (progress != NULL and progress != Py_None and not PyCallable_Check(progress)) {
+		PyErr_SetString(PyExc_TypeError, "progress must be callable");
+		return -1;
+	}
+	return 0;
+}
+
+static PyObject *put_many(PyObject *self, PyObject *args) {
+	PyObject* seq = NULL;
+	char* dst = NULL;
+	int writers = 0;
+	PyObject* progress = NULL;
+	if (PyArg_ParseTuple(args, "Os|iO", &seq, &dst, &writers, &progress) == 0 or progress_arg(progress) != 0) {
+		return NULL;
+	}
+	std::vector<std::string> srcs;
+	if (string_list(seq, srcs, "put_many() expects a sequence of local paths") != 0) {
+		return NULL;
+	}
+	bool report = (progress != NULL and progress != Py_None);
+
+	std::vector<int> result;
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.put_many(srcs, dst, writers, result, report ? put_progress_cb : NULL, progress);
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		errno = ret;
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, dst);
+	}
+
+	PyObject* list = PyList_New(result.size());
+	for (size_t i = 0; i < result.size(); i++) {
+		PyList_SetItem(list, i, Py_BuildValue("i", result[i]));
+	}
+	return list;
+}
+
+static PyObject *put_tree(PyObject *self, PyObject *args) {
+	char* src = NULL;
+	char* dst = NULL;
+	int writers = 0;
+	PyObject* progress = NULL;
+	if (PyArg_ParseTuple(args, "ss|iO", &src, &dst, &writers, &progress) == 0 or progress_arg(progress) != 0) {
+		return NULL;
+	}
+	bool report = (progress != NULL and progress != Py_None);
+
+	std::vector<std::string> srcs;
+	std::vector<int> result;
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.put_tree(src, dst, writers, srcs, result, report ? put_progress_cb : NULL, progress);
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		errno = ret;
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, src);
+	}
+
+	PyObject* dict = PyDict_New();
+	for (size_t i = 0; i < result.size(); i++) {
+		PyObject* status = Py_BuildValue("i", result[i]);
+		PyDict_SetItemString(dict, srcs[i].c_str(), status);
+		Py_DECREF(status);
+	}
+	return dict;
 }
 
 static PyObject *putf(PyObject *self, PyObject *args) {
@@ -116,7 +486,11 @@ static PyObject *putf(PyObject *self, PyObject *args) {
 	if (PyArg_ParseTuple(args, "ss", &src, &dst) == 0) {
 		return NULL;
 	}
-	return Py_BuildValue("i", hdfs.putf(src, dst));
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.putf(src, dst);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
 }
 
 static PyObject *rm(PyObject *self, PyObject *args) {
@@ -124,7 +498,11 @@ static PyObject *rm(PyObject *self, PyObject *args) {
 	if (PyArg_ParseTuple(args, "s", &path) == 0) {
 		return NULL;
 	}
-	return Py_BuildValue("i", hdfs.rm(path));
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.rm(path);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
 }
 
 static PyObject *exist(PyObject *self, PyObject *args) {
@@ -132,12 +510,313 @@ static PyObject *exist(PyObject *self, PyObject *args) {
 	if (PyArg_ParseTuple(args, "s", &path) == 0) {
 		return NULL;
 	}
-	if (hdfs.exist(path)) {
+	bool found = false;
+	Py_BEGIN_ALLOW_THREADS
+	found = hdfs.exist(path);
+	Py_END_ALLOW_THREADS
+	if (found) {
 		return Py_BuildValue("O", Py_True);
 	}
 	return Py_BuildValue("O", Py_False);
 }
 
+static PyObject *exist_many(PyObject *self, PyObject *args) {
+	PyObject* seq = NULL;
+	if (PyArg_ParseTuple(args, "O", &seq) == 0) {
+		return NULL;
+	}
+	std::vector<std::string> paths;
+	if (string_list(seq, paths, "exist_many() expects a sequence of paths") != 0) {
+		return NULL;
+	}
+	Py_ssize_t cnt = paths.size();
+
+	std::vector<bool> found;
+	Py_BEGIN_ALLOW_THREADS
+	hdfs.exist_many(paths, found);
+	Py_END_ALLOW_THREADS
+
+	PyObject* list = PyList_New(cnt);
+	for (Py_ssize_t i = 0; i < cnt; i++) {
+		PyObject* b = found[i] ? Py_True : Py_False;
+		Py_INCREF(b);
+		PyList_SetItem(list, i, b);
+	}
+	return list;
+}
+
+static PyObject *glob(PyObject *self, PyObject *args) {
+	char* pattern = NULL;
+	if (PyArg_ParseTuple(args, "s", &pattern) == 0) {
+		return NULL;
+	}
+	std::vector<std::string> matches;
+	Py_BEGIN_ALLOW_THREADS
+	hdfs.glob(pattern, matches);
+	Py_END_ALLOW_THREADS
+
+	PyObject* list = PyList_New(matches.size());
+	for(size_t i = 0; i < matches.size(); i++) {
+		PyList_SetItem(list, i, PyString_FromStringAndSize(matches[i].data(), matches[i].size()));
+	}
+	return list;
+}
+
+static PyObject *set_parallelism(PyObject *self, PyObject *args) {
+	int n = 0;
+	if (PyArg_ParseTuple(args, "i", &n) == 0) {
+		return NULL;
+	}
+	if (n <= 0) {
+		PyErr_SetString(PyExc_ValueError, "parallelism must be positive");
+		return NULL;
+	}
+	return Py_BuildValue("i", hdfs.set_parallelism(n));
+}
+
+static PyObject *set_pool_size(PyObject *self, PyObject *args) {
+	int n = 0;
+	if (PyArg_ParseTuple(args, "i", &n) == 0) {
+		return NULL;
+	}
+	if (n <= 0) {
+		PyErr_SetString(PyExc_ValueError, "pool size must be positive");
+		return NULL;
+	}
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.set_pool_size(n);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
+}
+
+static PyObject *warmup(PyObject *self, PyObject *args) {
+	PyObject* wait = NULL;
+	if (PyArg_ParseTuple(args, "|O", &wait) == 0) {
+		return NULL;
+	}
+	int block = (wait != NULL) ? PyObject_IsTrue(wait) : 0;
+	if (block < 0) {
+		return NULL;
+	}
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.warmup(block != 0);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
+}
+
+static PyObject *set_read_buffer(PyObject *self, PyObject *args) {
+	Py_ssize_t size = 0;
+	int readahead = 1;
+	if (PyArg_ParseTuple(args, "n|i", &size, &readahead) == 0) {
+		return NULL;
+	}
+	if (size <= 0) {
+		PyErr_SetString(PyExc_ValueError, "buffer size must be positive");
+		return NULL;
+	}
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.set_read_buffer(size, readahead != 0);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
+}
+
+static PyObject *set_write_buffer(PyObject *self, PyObject *args) {
+	Py_ssize_t size = 0;
+	if (PyArg_ParseTuple(args, "n", &size) == 0) {
+		return NULL;
+	}
+	if (size < 0) {
+		PyErr_SetString(PyExc_ValueError, "buffer size must not be negative");
+		return NULL;
+	}
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.set_write_buffer(size);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
+}
+
+static PyObject *set_put_buffers(PyObject *self, PyObject *args) {
+	Py_ssize_t size = 0;
+	int depth = 0;
+	if (PyArg_ParseTuple(args, "ni", &size, &depth) == 0) {
+		return NULL;
+	}
+	if (size <= 0 or depth <= 0) {
+		PyErr_SetString(PyExc_ValueError, "buffer size and depth must be positive");
+		return NULL;
+	}
+	return Py_BuildValue("i", hdfs.set_put_buffers(size, depth));
+}
+
+static PyObject *pool_stats(PyObject *self, PyObject *args) {
+	struct pool_stats st;
+	hdfs.pool.stats(&st);
+	return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:i,s:i,s:i}",
+		"leases", st.leases,
+		"waits", st.waits,
+		"connects", st.connects,
+		"reconnects", st.reconnects,
+		"failures", st.failures,
+		"size", st.size,
+		"opened", st.opened,
+		"idle", st.idle);
+}
+
+static PyObject *cache_config(PyObject *self, PyObject *args) {
+	int capacity = 0;
+	int ttl = 0;
+	if (PyArg_ParseTuple(args, "ii", &capacity, &ttl) == 0) {
+		return NULL;
+	}
+	if (capacity < 0 or ttl < 0) {
+		PyErr_SetString(PyExc_ValueError, "capacity and ttl must not be negative");
+		return NULL;
+	}
+	hdfs.cache.configure(capacity, ttl);
+	return Py_BuildValue("i", 0);
+}
+
+static PyObject *cache_clear(PyObject *self, PyObject *args) {
+	Py_BEGIN_ALLOW_THREADS
+	hdfs.cache.clear();
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", 0);
+}
+
+static PyObject *cache_stats(PyObject *self, PyObject *args) {
+	struct cache_stats st;
+	hdfs.cache.stats(&st);
+	return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:n,s:n}",
+		"hits", st.hits,
+		"misses", st.misses,
+		"negative_hits", st.negative_hits,
+		"evictions", st.evictions,
+		"invalidations", st.invalidations,
+		"entries", st.entries,
+		"records", st.records);
+}
+
+static PyObject* read_stats_dict(const read_stats &st) {
+	return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K}",
+		"files", (unsigned PY_LONG_LONG)st.files,
+		"bytes", (unsigned PY_LONG_LONG)st.bytes,
+		"local_bytes", (unsigned PY_LONG_LONG)st.local_bytes,
+		"short_circuit_bytes", (unsigned PY_LONG_LONG)st.short_circuit_bytes,
+		"zero_copy_bytes", (unsigned PY_LONG_LONG)st.zero_copy_bytes,
+		"remote_bytes", (unsigned PY_LONG_LONG)st.remote_bytes);
+}
+
+/* process totals, plus {path: stats} under "paths" when <per_path> is true */
+static PyObject *read_stats(PyObject *self, PyObject *args) {
+	PyObject* per_path = NULL;
+	if (PyArg_ParseTuple(args, "|O", &per_path) == 0) {
+		return NULL;
+	}
+	struct read_stats st;
+	hdfs.read_stats.totals(&st);
+	PyObject* dict = read_stats_dict(st);
+	if (dict == NULL) {
+		return NULL;
+	}
+	PyObject* untracked = Py_BuildValue("K", (unsigned PY_LONG_LONG)hdfs.read_stats.untracked());
+	PyDict_SetItemString(dict, "untracked_files", untracked);
+	Py_DECREF(untracked);
+	if (per_path == NULL or not PyObject_IsTrue(per_path)) {
+		return dict;
+	}
+
+	std::map<std::string, struct read_stats> paths;
+	Py_BEGIN_ALLOW_THREADS
+	hdfs.read_stats.paths(paths);
+	Py_END_ALLOW_THREADS
+	PyObject* by_path = PyDict_New();
+	for (std::map<std::string, struct read_stats>::iterator it = paths.begin(); it != paths.end(); ++it) {
+		PyObject* one = read_stats_dict(it->second);
+		PyDict_SetItemString(by_path, it->first.c_str(), one);
+		Py_DECREF(one);
+	}
+	PyDict_SetItemString(dict, "paths", by_path);
+	Py_DECREF(by_path);
+	return dict;
+}
+
+static PyObject *read_stats_config(PyObject *self, PyObject *args) {
+	PY_LONG_LONG log_bytes = -1;
+	if (PyArg_ParseTuple(args, "L", &log_bytes) == 0) {
+		return NULL;
+	}
+	hdfs.read_stats.configure(log_bytes < 0 ? -1 : log_bytes);
+	return Py_BuildValue("i", 0);
+}
+
+static PyObject *read_stats_clear(PyObject *self, PyObject *args) {
+	hdfs.read_stats.clear();
+	return Py_BuildValue("i", 0);
+}
+
+/* {name: {layer, count, errors, bytes, sum_ns, p50_ns, ..., max_ns}} of every
+ * libhdfs call and HDFS_FILE method made since the last metrics_clear() */
+static PyObject *metrics(PyObject *self, PyObject *args) {
+	std::vector<metric_summary> ops;
+	Py_BEGIN_ALLOW_THREADS
+	metrics_snapshot(ops);
+	Py_END_ALLOW_THREADS
+	PyObject* dict = PyDict_New();
+	for (size_t i = 0; i < ops.size(); i++) {
+		const metric_summary &s = ops[i];
+		PyObject* one = Py_BuildValue("{s:s,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+			"layer", s.layer,
+			"count", (unsigned PY_LONG_LONG)s.count,
+			"errors", (unsigned PY_LONG_LONG)s.errors,
+			"bytes", (unsigned PY_LONG_LONG)s.bytes,
+			"sum_ns", (unsigned PY_LONG_LONG)s.sum_ns,
+			"p50_ns", (unsigned PY_LONG_LONG)s.p50_ns,
+			"p90_ns", (unsigned PY_LONG_LONG)s.p90_ns,
+			"p99_ns", (unsigned PY_LONG_LONG)s.p99_ns,
+			"p999_ns", (unsigned PY_LONG_LONG)s.p999_ns,
+			"max_ns", (unsigned PY_LONG_LONG)s.max_ns);
+		if (one == NULL) {
+			Py_DECREF(dict);
+			return NULL;
+		}
+		PyDict_SetItemString(dict, s.name, one);
+		Py_DECREF(one);
+	}
+	return dict;
+}
+
+static PyObject *metrics_config(PyObject *self, PyObject *args) {
+	PyObject* on = NULL;
+	if (PyArg_ParseTuple(args, "O", &on) == 0) {
+		return NULL;
+	}
+	metrics_enable(PyObject_IsTrue(on));
+	return Py_BuildValue("i", 0);
+}
+
+static PyObject *metrics_clear(PyObject *self, PyObject *args) {
+	Py_BEGIN_ALLOW_THREADS
+	::metrics_clear();
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", 0);
+}
+
+static PyObject *metrics_export(PyObject *self, PyObject *args) {
+	char* path = NULL;
+	int interval = 0;
+	if (PyArg_ParseTuple(args, "si", &path, &interval) == 0) {
+		return NULL;
+	}
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = ::metrics_export(path, interval);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
+}
 
 static PyObject *chown(PyObject *self, PyObject *args) {
 	char* path = NULL;
@@ -146,7 +825,11 @@ static PyObject *chown(PyObject *self, PyObject *args) {
 	if (PyArg_ParseTuple(args, "sss", &path, &owner, &group) == 0) {
 		return NULL;
 	}
-	return Py_BuildValue("i", hdfs.chown(path, owner, group));
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.chown(path, owner, group);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
 }
 
 static PyObject *chmod(PyObject *self, PyObject *args) {
@@ -155,7 +838,110 @@ static PyObject *chmod(PyObject *self, PyObject *args) {
 	if (PyArg_ParseTuple(args, "si", &path, &mode) == 0) {
 		return NULL;
 	}
-	return Py_BuildValue("i", hdfs.chmod(path, mode));
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.chmod(path, mode);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
+}
+
+/* <obj> is one path or pattern or a sequence of them, {path: 0/errorno} returned */
+static PyObject* bulk(PyObject* obj, const bulk_args &a, int in_flight) {
+	std::vector<std::string> paths;
+	if (PyString_Check(obj)) {
+		paths.push_back(std::string(PyString_AS_STRING(obj), PyString_GET_SIZE(obj)));
+	} else if (string_list(obj, paths, "expected a path or a sequence of paths") != 0) {
+		return NULL;
+	}
+	if (in_flight < 0) {
+		PyErr_SetString(PyExc_ValueError, "in_flight must not be negative");
+		return NULL;
+	}
+
+	std::vector<std::string> targets;
+	std::vector<int> result;
+	Py_BEGIN_ALLOW_THREADS
+	hdfs.bulk(paths, a, in_flight, targets, result);
+	Py_END_ALLOW_THREADS
+
+	PyObject* dict = PyDict_New();
+	for (size_t i = 0; i < targets.size(); i++) {
+		PyObject* status = Py_BuildValue("i", result[i]);
+		PyDict_SetItemString(dict, targets[i].c_str(), status);
+		Py_DECREF(status);
+	}
+	return dict;
+}
+
+static PyObject *rm_many(PyObject *self, PyObject *args) {
+	PyObject* paths = NULL;
+	bulk_args a = bulk_args();
+	int in_flight = 0;
+	if (PyArg_ParseTuple(args, "O|i", &paths, &in_flight) == 0) {
+		return NULL;
+	}
+	a.op = BULK_RM;
+	return bulk(paths, a, in_flight);
+}
+
+static PyObject *chmod_many(PyObject *self, PyObject *args) {
+	PyObject* paths = NULL;
+	bulk_args a = bulk_args();
+	int mode = 0;
+	int in_flight = 0;
+	if (PyArg_ParseTuple(args, "Oi|i", &paths, &mode, &in_flight) == 0) {
+		return NULL;
+	}
+	a.op = BULK_CHMOD;
+	a.mode = mode;
+	return bulk(paths, a, in_flight);
+}
+
+static PyObject *chown_many(PyObject *self, PyObject *args) {
+	PyObject* paths = NULL;
+	bulk_args a = bulk_args();
+	int in_flight = 0;
+	if (PyArg_ParseTuple(args, "Ozz|i", &paths, &a.owner, &a.group, &in_flight) == 0) {
+		return NULL;
+	}
+	if (a.owner == NULL and a.group == NULL) {
+		PyErr_SetString(PyExc_ValueError, "owner and group cannot both be None");
+		return NULL;
+	}
+	a.op = BULK_CHOWN;
+	return bulk(paths, a, in_flight);
+}
+
+static PyObject *set_replication(PyObject *self, PyObject *args) {
+	PyObject* paths = NULL;
+	bulk_args a = bulk_args();
+	int replication = 0;
+	int in_flight = 0;
+	if (PyArg_ParseTuple(args, "Oi|i", &paths, &replication, &in_flight) == 0) {
+		return NULL;
+	}
+	if (replication <= 0 or replication > 512) {
+		PyErr_SetString(PyExc_ValueError, "replication must be between 1 and 512");
+		return NULL;
+	}
+	a.op = BULK_SETREP;
+	a.replication = replication;
+	return bulk(paths, a, in_flight);
+}
+
+static PyObject *utime(PyObject *self, PyObject *args) {
+	PyObject* paths = NULL;
+	bulk_args a = bulk_args();
+	PY_LONG_LONG mtime = -1;
+	PY_LONG_LONG atime = -1;
+	int in_flight = 0;
+	if (PyArg_ParseTuple(args, "OLL|i", &paths, &mtime, &atime, &in_flight) == 0) {
+		return NULL;
+	}
+	a.op = BULK_UTIME;
+	a.mtime = mtime;
+	a.atime = atime;
+	return bulk(paths, a, in_flight);
 }
 
 static PyObject *mkdir(PyObject *self, PyObject *args) {
@@ -163,7 +949,11 @@ static PyObject *mkdir(PyObject *self, PyObject *args) {
 	if (PyArg_ParseTuple(args, "s", &path) == 0) {
 		return NULL;
 	}
-	return Py_BuildValue("i", hdfs.mkdir(path));
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.mkdir(path);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
 }
 
 static PyObject *getmerge(PyObject *self, PyObject *args) {
@@ -172,51 +962,1253 @@ static PyObject *getmerge(PyObject *self, PyObject *args) {
 	if (PyArg_ParseTuple(args, "ss", &src, &dst) == 0) {
 		return NULL;
 	}
-	return Py_BuildValue("i", hdfs.getmerge(src, dst));
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.getmerge(src, dst);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
 }
 
-static PyObject *dirinfo(PyObject *self, PyObject *args) {
-	char* path = NULL;
-	if (PyArg_ParseTuple(args, "s", &path) == 0) {
+static PyObject *get(PyObject *self, PyObject *args) {
+	char* src = NULL;
+	char* dst = NULL;
+	int streams = 0;
+	if (PyArg_ParseTuple(args, "ss|i", &src, &dst, &streams) == 0) {
 		return NULL;
 	}
-	hdfsFileInfo* fs = hdfs.dirinfo(path);
-	if (fs == NULL) {
-		return Py_BuildValue("()");
-	} else {
-		PyObject *tuple = PyTuple_New(2);
-		PyTuple_SetItem(tuple, 0, Py_BuildValue("s", fs->mName));
-		PyTuple_SetItem(tuple, 1, Py_BuildValue("l", fs->mLastMod));
-		hdfsFreeFileInfo(fs, 1);
-		return tuple;
+	if (streams < 0) {
+		PyErr_SetString(PyExc_ValueError, "streams must not be negative");
+		return NULL;
 	}
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.get(src, dst, streams);
+	Py_END_ALLOW_THREADS
+	return Py_BuildValue("i", ret);
 }
 
+static PyObject *blocks(PyObject *self, PyObject *args) {
+	char* pattern = NULL;
+	if (PyArg_ParseTuple(args, "s", &pattern) == 0) {
+		return NULL;
+	}
+	std::vector<block_location> locations;
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.blocks(pattern, locations);
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		errno = ret;
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, pattern);
+	}
 
+	PyObject* list = PyList_New(locations.size());
+	for (size_t i = 0; i < locations.size(); i++) {
+		const block_location &b = locations[i];
+		PyObject* hosts = PyList_New(b.hosts.size());
+		for (size_t j = 0; j < b.hosts.size(); j++) {
+			PyList_SetItem(hosts, j, PyString_FromStringAndSize(b.hosts[j].data(), b.hosts[j].size()));
+		}
+		PyList_SetItem(list, i, Py_BuildValue("(sLLN)", b.path.c_str(), (PY_LONG_LONG)b.offset, (PY_LONG_LONG)b.length, hosts));
+	}
+	return list;
+}
 
-static PyMethodDef ExtestMethods[] = {
-	{"ls",         ls,         METH_VARARGS, "ls(path)                  list contents of <path>, python-list returned"},
-	{"mv",         mv,         METH_VARARGS, "mv(old, new)              move path from <old> to <new>, 0/errorno returned"},
-	{"rm",         rm,         METH_VARARGS, "rm(path)                  rm -r <path>, 0/errorno returned"},
-	{"put",        put,        METH_VARARGS, "put(local, remote)        upload file to hdfs, 0/errorno returned"},
-	{"putf",       putf,       METH_VARARGS, "putf(local, remote)       force upload file to hdfs, 0/errorno returned"},
-	{"mkdir",      mkdir,      METH_VARARGS, "mkdir(path)               mkdir of path, 0/errorno returned"},
-	{"chmod",      chmod,      METH_VARARGS, "chmod(path, mode)         mode must be int like 655,644, 0/errorno returned"},
-	{"chown",      chown,      METH_VARARGS, "chown(path, owner, group) all parameters should be string, 0/errorno returned"},
-	{"exist",      exist,      METH_VARARGS, "exist(path)               whether <path> exists, True/False returned"},
-	{"open",       open,       METH_VARARGS, "open(path, mode)          mode should be 'r' or 'w', 0/errorno returned, remeber to call close() at the end"},
-	{"close",      close,      METH_VARARGS, "close()                   close hdfsFile which is opened by the last open(path, mode) call"},
+static PyObject *splits(PyObject *self, PyObject *args) {
+	char* pattern = NULL;
+	PyObject* seq = NULL;
+	PY_LONG_LONG split_size = 0;
+	if (PyArg_ParseTuple(args, "sO|L", &pattern, &seq, &split_size) == 0) {
+		return NULL;
+	}
+	std::vector<std::string> workers;
+	if (string_list(seq, workers, "splits() expects a sequence of worker host names") != 0) {
+		return NULL;
+	}
+	if (workers.empty() or split_size < 0) {
+		PyErr_SetString(PyExc_ValueError, "splits() needs at least one worker and a split size of 0 or more");
+		return NULL;
+	}
+	std::vector<std::vector<file_split> > assigned;
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.splits(pattern, workers, split_size, assigned);
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		errno = ret;
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, pattern);
+	}
+
+	PyObject* list = PyList_New(assigned.size());
+	for (size_t i = 0; i < assigned.size(); i++) {
+		PyObject* mine = PyList_New(assigned[i].size());
+		for (size_t j = 0; j < assigned[i].size(); j++) {
+			const file_split &sp = assigned[i][j];
+			PyList_SetItem(mine, j, Py_BuildValue("(sLLN)", sp.path.c_str(), (PY_LONG_LONG)sp.offset,
+				(PY_LONG_LONG)sp.length, PyBool_FromLong(sp.local)));
+		}
+		PyList_SetItem(list, i, mine);
+	}
+	return list;
+}
+
+static PyObject *du(PyObject *self, PyObject *args) {
+	char* path = NULL;
+	Py_ssize_t top_n = 0;
+	PyObject* histogram = NULL;
+	if (PyArg_ParseTuple(args, "s|nO", &path, &top_n, &histogram) == 0) {
+		return NULL;
+	}
+	du_summary summary;
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.du(path, top_n > 0 ? top_n : 0, summary);
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		errno = ret;
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+	}
+
+	PyObject* dict = Py_BuildValue("{s:L,s:L,s:L,s:L,s:L}",
+		"bytes", (PY_LONG_LONG)summary.bytes,
+		"replicated_bytes", (PY_LONG_LONG)summary.replicated_bytes,
+		"files", (PY_LONG_LONG)summary.files,
+		"dirs", (PY_LONG_LONG)summary.dirs,
+		"errors", (PY_LONG_LONG)summary.errors);
+	if (dict == NULL) {
+		return NULL;
+	}
+	if (top_n > 0) {
+		PyObject* top = PyList_New(summary.top.size());
+		for (size_t i = 0; i < summary.top.size(); i++) {
+			PyList_SetItem(top, i, Py_BuildValue("(sL)", summary.top[i].first.c_str(), (PY_LONG_LONG)summary.top[i].second));
+		}
+		PyDict_SetItemString(dict, "top", top);
+		Py_DECREF(top);
+	}
+	if (histogram != NULL and PyObject_IsTrue(histogram)) {
+		int used = DU_HISTOGRAM_BUCKETS;
+		while (used > 0 and summary.histogram[used - 1] == 0) {
+			used--;
+		}
+		PyObject* list = PyList_New(used);
+		for (int i = 0; i < used; i++) {
+			PyList_SetItem(list, i, PyLong_FromLongLong(summary.histogram[i]));
+		}
+		PyDict_SetItemString(dict, "histogram", list);
+		Py_DECREF(list);
+	}
+	return dict;
+}
+
+static PyObject *count(PyObject *self, PyObject *args) {
+	char* path = NULL;
+	if (PyArg_ParseTuple(args, "s", &path) == 0) {
+		return NULL;
+	}
+	du_summary summary;
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.du(path, 0, summary);
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		errno = ret;
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+	}
+	return Py_BuildValue("{s:L,s:L,s:L}",
+		"dirs", (PY_LONG_LONG)summary.dirs,
+		"files", (PY_LONG_LONG)summary.files,
+		"bytes", (PY_LONG_LONG)summary.bytes);
+}
+
+static PyObject *dirinfo(PyObject *self, PyObject *args) {
+	char* path = NULL;
+	if (PyArg_ParseTuple(args, "s", &path) == 0) {
+		return NULL;
+	}
+	hdfsFileInfo* fs = NULL;
+	Py_BEGIN_ALLOW_THREADS
+	fs = hdfs.dirinfo(path);
+	Py_END_ALLOW_THREADS
+	if (fs == NULL) {
+		return Py_BuildValue("()");
+	} else {
+		PyObject *tuple = PyTuple_New(2);
+		PyTuple_SetItem(tuple, 0, Py_BuildValue("s", fs->mName));
+		PyTuple_SetItem(tuple, 1, Py_BuildValue("l", fs->mLastMod));
+		hdfsFreeFileInfo(fs, 1);
+		return tuple;
+	}
+}
+
+
+
+static char* walk_kwlist[] = {(char*)"path", (char*)"name_glob", (char*)"min_size", (char*)"max_size",
+	(char*)"mtime_after", (char*)"mtime_before", (char*)"kind", (char*)"max_depth", (char*)"prune", NULL};
+
+/* walk() and find() take the same keywords, see walk_filter */
+static int walk_args(PyObject* args, PyObject* kwds, char** path, walk_filter* f) {
+	char* name_glob = NULL;
+	PY_LONG_LONG min_size = -1;
+	PY_LONG_LONG max_size = -1;
+	PY_LONG_LONG mtime_after = 0;
+	PY_LONG_LONG mtime_before = 0;
+	char* kind = NULL;
+	int max_depth = 0;
+	PyObject* prune = NULL;
+	if (PyArg_ParseTupleAndKeywords(args, kwds, "s|zLLLLziO", walk_kwlist, path, &name_glob, &min_size, &max_size,
+			&mtime_after, &mtime_before, &kind, &max_depth, &prune) == 0) {
+		return -1;
+	}
+	f->kind = 0;
+	if (kind != NULL) {
+		if (strcmp(kind, "f") == 0 or strcmp(kind, "file") == 0) {
+			f->kind = 'F';
+		} else if (strcmp(kind, "d") == 0 or strcmp(kind, "dir") == 0) {
+			f->kind = 'D';
+		} else {
+			PyErr_Format(PyExc_ValueError, "kind should be 'f' or 'd', not '%s'", kind);
+			return -1;
+		}
+	}
+	f->name_glob = name_glob;
+	f->min_size = min_size;
+	f->max_size = max_size;
+	f->mtime_after = mtime_after;
+	f->mtime_before = mtime_before;
+	f->max_depth = max_depth;
+	f->prune = (prune != NULL and PyObject_IsTrue(prune));
+	return 0;
+}
+
+/* walk() runs HDFS_FILE::walk() on a thread of its own, which hands the
+ * matches over in batches of up to WALK_BATCH entries. it stops listing
+ * while WALK_BATCHES batches are waiting, so a generator left unconsumed
+ * costs little. the walk checks in after every directory it lists, which
+ * hands a partial batch over once it is WALK_FLUSH_MS old and stops the
+ * walk soon after the generator is dropped, matches or not. */
+#define WALK_BATCH 1024
+#define WALK_BATCHES 8
+#define WALK_FLUSH_MS 100  /* a batch is handed over after this long even if not full */
+
+struct walk_entry {
+	std::string path;
+	char kind;
+	tOffset size;
+	tTime mtime;
+	short replication;
+	std::string owner;
+	std::string group;
+	short permissions;
+};
+
+struct walk_channel {
+	std::string path;
+	std::string name_glob;
+	walk_filter filter;
+	std::deque<std::vector<walk_entry>*> batches;
+	std::vector<walk_entry>* filling;
+	struct timespec flushed;
+	bool done;
+	bool cancelled;
+	int err;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static long elapsed_ms(const struct timespec &since) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since.tv_sec) * 1000 + (now.tv_nsec - since.tv_nsec) / 1000000;
+}
+
+static void walk_flush(walk_channel* ch) {
+	pthread_mutex_lock(&ch->lock);
+	while (ch->batches.size() >= WALK_BATCHES and not ch->cancelled) {
+		pthread_cond_wait(&ch->cond, &ch->lock);
+	}
+	ch->batches.push_back(ch->filling);
+	pthread_cond_broadcast(&ch->cond);
+	pthread_mutex_unlock(&ch->lock);
+	ch->filling = new std::vector<walk_entry>;
+	ch->filling->reserve(WALK_BATCH);
+	clock_gettime(CLOCK_MONOTONIC, &ch->flushed);
+}
+
+static bool walk_cancelled(walk_channel* ch) {
+	pthread_mutex_lock(&ch->lock);
+	bool cancelled = ch->cancelled;
+	pthread_mutex_unlock(&ch->lock);
+	return cancelled;
+}
+
+/* a match, or NULL once a directory has been listed */
+static int walk_collect(const hdfsFileInfo* info, void* ctx) {
+	walk_channel* ch = reinterpret_cast<walk_channel*>(ctx);
+	if (info != NULL) {
+		walk_entry e;
+		ch->filling->push_back(e);
+		walk_entry &entry = ch->filling->back();
+		entry.path = info->mName;
+		entry.kind = (info->mKind == kObjectKindDirectory) ? 'D' : 'F';
+		entry.size = info->mSize;
+		entry.mtime = info->mLastMod;
+		entry.replication = info->mReplication;
+		entry.owner = (info->mOwner != NULL) ? info->mOwner : "";
+		entry.group = (info->mGroup != NULL) ? info->mGroup : "";
+		entry.permissions = info->mPermissions;
+	}
+	if (ch->filling->size() >= WALK_BATCH or
+			(not ch->filling->empty() and elapsed_ms(ch->flushed) >= WALK_FLUSH_MS)) {
+		walk_flush(ch);
+	}
+	return walk_cancelled(ch) ? 1 : 0;
+}
+
+static void* walk_main(void* arg) {
+	walk_channel* ch = reinterpret_cast<walk_channel*>(arg);
+	int err = hdfs.walk(ch->path.c_str(), ch->filter, walk_collect, ch);
+	if (not ch->filling->empty()) {
+		walk_flush(ch);
+	}
+	delete ch->filling;
+	ch->filling = NULL;
+	pthread_mutex_lock(&ch->lock);
+	ch->err = err;
+	ch->done = true;
+	pthread_cond_broadcast(&ch->cond);
+	pthread_mutex_unlock(&ch->lock);
+	return NULL;
+}
+
+typedef struct {
+	PyObject_HEAD
+	walk_channel* ch;
+	std::vector<walk_entry>* batch;
+	size_t next;
+} WalkIter;
+
+static void WalkIter_dealloc(WalkIter* self) {
+	walk_channel* ch = self->ch;
+	if (ch != NULL) {
+		Py_BEGIN_ALLOW_THREADS
+		pthread_mutex_lock(&ch->lock);
+		ch->cancelled = true;
+		pthread_cond_broadcast(&ch->cond);
+		pthread_mutex_unlock(&ch->lock);
+		pthread_join(ch->thread, NULL);
+		Py_END_ALLOW_THREADS
+		for (size_t i = 0; i < ch->batches.size(); i++) {
+			delete ch->batches[i];
+		}
+		pthread_cond_destroy(&ch->cond);
+		pthread_mutex_destroy(&ch->lock);
+		delete ch;
+	}
+	delete self->batch;
+	PyObject_Del(self);
+}
+
+static PyObject* WalkIter_iternext(WalkIter* self) {
+	if (self->batch == NULL or self->next == self->batch->size()) {
+		delete self->batch;
+		self->batch = NULL;
+		self->next = 0;
+		walk_channel* ch = self->ch;
+		int err = 0;
+		Py_BEGIN_ALLOW_THREADS
+		pthread_mutex_lock(&ch->lock);
+		while (ch->batches.empty() and not ch->done) {
+			pthread_cond_wait(&ch->cond, &ch->lock);
+		}
+		if (not ch->batches.empty()) {
+			self->batch = ch->batches.front();
+			ch->batches.pop_front();
+			pthread_cond_broadcast(&ch->cond);
+		} else {
+			err = ch->err;
+			ch->err = 0;  /* raised once */
+		}
+		pthread_mutex_unlock(&ch->lock);
+		Py_END_ALLOW_THREADS
+		if (self->batch == NULL) {
+			if (err != 0) {
+				errno = err;
+				PyErr_SetFromErrnoWithFilename(PyExc_IOError, const_cast<char*>(ch->path.c_str()));
+			}
+			return NULL;
+		}
+	}
+	const walk_entry &e = (*self->batch)[self->next++];
+	return Py_BuildValue("(s#cLLiss#i)", e.path.data(), (Py_ssize_t)e.path.size(), e.kind,
+		(PY_LONG_LONG)e.size, (PY_LONG_LONG)e.mtime, (int)e.replication,
+		e.owner.c_str(), e.group.data(), (Py_ssize_t)e.group.size(), (int)e.permissions);
+}
+
+static PyTypeObject WalkIterType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"awesome_hdfs.WalkIter",                  /* tp_name */
+	sizeof(WalkIter),                         /* tp_basicsize */
+	0,                                        /* tp_itemsize */
+	(destructor)WalkIter_dealloc,             /* tp_dealloc */
+	0,                                        /* tp_print */
+	0,                                        /* tp_getattr */
+	0,                                        /* tp_setattr */
+	0,                                        /* tp_compare */
+	0,                                        /* tp_repr */
+	0,                                        /* tp_as_number */
+	0,                                        /* tp_as_sequence */
+	0,                                        /* tp_as_mapping */
+	0,                                        /* tp_hash */
+	0,                                        /* tp_call */
+	0,                                        /* tp_str */
+	0,                                        /* tp_getattro */
+	0,                                        /* tp_setattro */
+	0,                                        /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_ITER, /* tp_flags */
+	"entries found by walk()",                /* tp_doc */
+	0,                                        /* tp_traverse */
+	0,                                        /* tp_clear */
+	0,                                        /* tp_richcompare */
+	0,                                        /* tp_weaklistoffset */
+	PyObject_SelfIter,                        /* tp_iter */
+	(iternextfunc)WalkIter_iternext,          /* tp_iternext */
+};
+
+static PyObject *walk(PyObject *self, PyObject *args, PyObject *kwds) {
+	char* path = NULL;
+	walk_filter filter;
+	if (walk_args(args, kwds, &path, &filter) != 0) {
+		return NULL;
+	}
+	WalkIter* it = PyObject_New(WalkIter, &WalkIterType);
+	if (it == NULL) {
+		return NULL;
+	}
+	it->batch = NULL;
+	it->next = 0;
+	it->ch = NULL;
+
+	walk_channel* ch = new walk_channel;
+	ch->path = path;
+	ch->filter = filter;
+	if (filter.name_glob != NULL) {
+		ch->name_glob = filter.name_glob;
+		ch->filter.name_glob = ch->name_glob.c_str();
+	}
+	ch->filling = new std::vector<walk_entry>;
+	ch->filling->reserve(WALK_BATCH);
+	clock_gettime(CLOCK_MONOTONIC, &ch->flushed);
+	ch->done = false;
+	ch->cancelled = false;
+	ch->err = 0;
+	pthread_mutex_init(&ch->lock, NULL);
+	pthread_cond_init(&ch->cond, NULL);
+	int err = pthread_create(&ch->thread, NULL, walk_main, ch);
+	if (err != 0) {
+		pthread_cond_destroy(&ch->cond);
+		pthread_mutex_destroy(&ch->lock);
+		delete ch->filling;
+		delete ch;
+		Py_DECREF(it);
+		errno = err;
+		return PyErr_SetFromErrno(PyExc_OSError);
+	}
+	it->ch = ch;
+	return reinterpret_cast<PyObject*>(it);
+}
+
+static int find_collect(const hdfsFileInfo* info, void* ctx) {
+	if (info == NULL) {
+		return 0;
+	}
+	reinterpret_cast<std::vector<std::string>*>(ctx)->push_back(info->mName);
+	return 0;
+}
+
+static PyObject *find(PyObject *self, PyObject *args, PyObject *kwds) {
+	char* path = NULL;
+	walk_filter filter;
+	if (walk_args(args, kwds, &path, &filter) != 0) {
+		return NULL;
+	}
+	std::vector<std::string> found;
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = hdfs.walk(path, filter, find_collect, &found);
+	std::sort(found.begin(), found.end());
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		errno = ret;
+		return PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+	}
+	PyObject* list = PyList_New(found.size());
+	for (size_t i = 0; i < found.size(); i++) {
+		PyList_SetItem(list, i, PyString_FromStringAndSize(found[i].data(), found[i].size()));
+	}
+	return list;
+}
+
+
+
+/* HDFSFile(path, mode='r'): a file object of its own, any number of them may
+ * be open at once. it follows python file semantics and raises IOError. */
+typedef struct {
+	PyObject_HEAD
+	HDFS_STREAM* f;
+	PyObject* path;
+	PyObject* batch;  /* lines read ahead by iteration */
+	Py_ssize_t next;  /* the first of them not handed out yet */
+	int zero_copy;    /* how the last read_zero() went: 1 mapped, 0 copied, -1 not called */
+} HDFSFile;
+
+#define ITER_BATCH_LINES 1024
+#define ITER_BATCH_BYTES (1024*1024)
+
+static HDFS_STREAM* opened(HDFSFile* self) {
+	if (self->f == NULL or not self->f->is_open()) {
+		PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+		return NULL;
+	}
+	return self->f;
+}
+
+static Py_ssize_t pending(HDFSFile* self) {
+	return (self->batch == NULL) ? 0 : PyList_GET_SIZE(self->batch) - self->next;
+}
+
+static void drop_batch(HDFSFile* self) {
+	Py_CLEAR(self->batch);
+	self->next = 0;
+}
+
+static PyObject* io_error(HDFSFile* self) {
+	if (errno == 0) {
+		errno = EIO;
+	}
+	return PyErr_SetFromErrnoWithFilenameObject(PyExc_IOError, self->path);
+}
+
+/* opened() for the calls that write, IOError EBADF on a file open for reading */
+static HDFS_STREAM* opened_for_write(HDFSFile* self) {
+	HDFS_STREAM* f = opened(self);
+	if (f != NULL and not f->writable()) {
+		errno = EBADF;
+		io_error(self);
+		return NULL;
+	}
+	return f;
+}
+
+static void HDFSFile_dealloc(HDFSFile* self) {
+	HDFS_STREAM* f = self->f;
+	self->f = NULL;
+	if (f != NULL) {
+		Py_BEGIN_ALLOW_THREADS
+		delete f;
+		Py_END_ALLOW_THREADS
+	}
+	Py_XDECREF(self->path);
+	drop_batch(self);
+	Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+/* the data of one hadoopReadZero() call, handed to python as a memoryview.
+ * it keeps its HDFSFile alive and gives the buffer back once the last view
+ * of it is gone. */
+typedef struct {
+	PyObject_HEAD
+	HDFSFile* file;
+	struct hadoopRzBuffer* rz;
+} ZeroCopyBuffer;
+
+static void ZeroCopyBuffer_dealloc(ZeroCopyBuffer* self) {
+	HDFS_STREAM* f = self->file->f;
+	struct hadoopRzBuffer* rz = self->rz;
+	Py_BEGIN_ALLOW_THREADS
+	f->release_zero(rz);
+	Py_END_ALLOW_THREADS
+	Py_DECREF(self->file);
+	Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+static int ZeroCopyBuffer_getbuffer(ZeroCopyBuffer* self, Py_buffer* view, int flags) {
+	void* data = const_cast<void*>(hadoopRzBufferGet(self->rz));
+	return PyBuffer_FillInfo(view, reinterpret_cast<PyObject*>(self), data, hadoopRzBufferLength(self->rz), 1, flags);
+}
+
+static PyBufferProcs ZeroCopyBufferProcs = {
+	0,                                        /* bf_getreadbuffer */
+	0,                                        /* bf_getwritebuffer */
+	0,                                        /* bf_getsegcount */
+	0,                                        /* bf_getcharbuffer */
+	(getbufferproc)ZeroCopyBuffer_getbuffer,  /* bf_getbuffer */
+	0,                                        /* bf_releasebuffer */
+};
+
+static PyTypeObject ZeroCopyBufferType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"awesome_hdfs.ZeroCopyBuffer",            /* tp_name */
+	sizeof(ZeroCopyBuffer),                   /* tp_basicsize */
+	0,                                        /* tp_itemsize */
+	(destructor)ZeroCopyBuffer_dealloc,       /* tp_dealloc */
+	0,                                        /* tp_print */
+	0,                                        /* tp_getattr */
+	0,                                        /* tp_setattr */
+	0,                                        /* tp_compare */
+	0,                                        /* tp_repr */
+	0,                                        /* tp_as_number */
+	0,                                        /* tp_as_sequence */
+	0,                                        /* tp_as_mapping */
+	0,                                        /* tp_hash */
+	0,                                        /* tp_call */
+	0,                                        /* tp_str */
+	0,                                        /* tp_getattro */
+	0,                                        /* tp_setattro */
+	&ZeroCopyBufferProcs,                     /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /* tp_flags */
+	"data read by HDFSFile.read_zero()",      /* tp_doc */
+};
+
+/* raised instead of closing a file whose zero-copy buffers are still around */
+static int busy(HDFSFile* self) {
+	if (self->f != NULL and self->f->zero_buffers() > 0) {
+		PyErr_SetString(PyExc_BufferError, "cannot close a file while read_zero() buffers are in use");
+		return 1;
+	}
+	return 0;
+}
+
+static int HDFSFile_init(HDFSFile* self, PyObject* args, PyObject* kwds) {
+	static char* kwlist[] = {(char*)"path", (char*)"mode", NULL};
+	char* path = NULL;
+	char* mode = (char*)"r";
+	if (PyArg_ParseTupleAndKeywords(args, kwds, "s|s", kwlist, &path, &mode) == 0) {
+		return -1;
+	}
+	if (strcmp(mode, "r") != 0 and strcmp(mode, "w") != 0 and strcmp(mode, "a") != 0) {
+		PyErr_Format(PyExc_ValueError, "mode should be 'r', 'w' or 'a', not '%s'", mode);
+		return -1;
+	}
+	if (busy(self)) {
+		return -1;
+	}
+	self->zero_copy = -1;
+
+	drop_batch(self);
+	HDFS_STREAM* old = self->f;
+	HDFS_STREAM* f = NULL;
+	int err = 0;
+	Py_BEGIN_ALLOW_THREADS
+	delete old;
+	f = hdfs.open_stream(path, mode);
+	err = errno;
+	Py_END_ALLOW_THREADS
+	self->f = f;
+	Py_XDECREF(self->path);
+	self->path = PyString_FromString(path);
+
+	if (f == NULL) {
+		errno = err;
+		io_error(self);
+		return -1;
+	}
+	return 0;
+}
+
+/* <size> bytes, fewer only when hdfsRead reports the end of the file */
+static PyObject* read_sized(HDFSFile* self, HDFS_STREAM* f, Py_ssize_t size) {
+	PyObject* str = PyString_FromStringAndSize(NULL, size);
+	if (str == NULL or size == 0) {
+		return str;
+	}
+	ssize_t cnt = 0;
+	Py_BEGIN_ALLOW_THREADS
+	cnt = f->read_fully(PyString_AS_STRING(str), size);
+	Py_END_ALLOW_THREADS
+	if (cnt < 0) {
+		Py_DECREF(str);
+		return io_error(self);
+	}
+	if (cnt < size) {
+		_PyString_Resize(&str, cnt);
+	}
+	return str;
+}
+
+static PyObject* HDFSFile_read(HDFSFile* self, PyObject* args) {
+	Py_ssize_t size = -1;
+	if (PyArg_ParseTuple(args, "|n", &size) == 0) {
+		return NULL;
+	}
+	HDFS_STREAM* f = opened(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	if (pending(self) > 0) {
+		PyErr_SetString(PyExc_ValueError, "Mixing iteration and read methods would lose data");
+		return NULL;
+	}
+
+	if (size < 0) { /* the rest of the file */
+		std::string data;
+		ssize_t cnt = 0;
+		Py_BEGIN_ALLOW_THREADS
+		char chunk[65536];
+		while ((cnt = f->read_fully(chunk, sizeof(chunk))) > 0) {
+			data.append(chunk, cnt);
+		}
+		Py_END_ALLOW_THREADS
+		if (cnt < 0) {
+			return io_error(self);
+		}
+		return PyString_FromStringAndSize(data.data(), data.size());
+	}
+
+	return read_sized(self, f, size);
+}
+
+/* read(size) without the "rest of the file" form, '' only at the end */
+static PyObject* HDFSFile_read_bytes(HDFSFile* self, PyObject* args) {
+	Py_ssize_t size = 0;
+	if (PyArg_ParseTuple(args, "n", &size) == 0) {
+		return NULL;
+	}
+	if (size < 0) {
+		PyErr_SetString(PyExc_ValueError, "size must not be negative");
+		return NULL;
+	}
+	HDFS_STREAM* f = opened(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	if (pending(self) > 0) {
+		PyErr_SetString(PyExc_ValueError, "Mixing iteration and read methods would lose data");
+		return NULL;
+	}
+	return read_sized(self, f, size);
+}
+
+/* fills a writable buffer-protocol object, the number of bytes read returned */
+static PyObject* HDFSFile_readinto(HDFSFile* self, PyObject* args) {
+	Py_buffer data;
+	if (PyArg_ParseTuple(args, "w*", &data) == 0) {
+		return NULL;
+	}
+	HDFS_STREAM* f = opened(self);
+	if (f == NULL or pending(self) > 0) {
+		if (f != NULL) {
+			PyErr_SetString(PyExc_ValueError, "Mixing iteration and read methods would lose data");
+		}
+		PyBuffer_Release(&data);
+		return NULL;
+	}
+	ssize_t cnt = 0;
+	Py_BEGIN_ALLOW_THREADS
+	cnt = f->read_fully(data.buf, data.len);
+	Py_END_ALLOW_THREADS
+	PyBuffer_Release(&data);
+	if (cnt < 0) {
+		return io_error(self);
+	}
+	return Py_BuildValue("n", cnt);
+}
+
+static PyObject* HDFSFile_readline(HDFSFile* self, PyObject* args) {
+	HDFS_STREAM* f = opened(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	if (pending(self) > 0) {
+		PyObject* line = PyList_GET_ITEM(self->batch, self->next++);
+		Py_INCREF(line);
+		return line;
+	}
+	return read_line(f);
+}
+
+static PyObject* HDFSFile_readlines(HDFSFile* self, PyObject* args) {
+	Py_ssize_t max_lines = 0;
+	Py_ssize_t max_bytes = 0;
+	if (PyArg_ParseTuple(args, "|nn", &max_lines, &max_bytes) == 0) {
+		return NULL;
+	}
+	HDFS_STREAM* f = opened(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	max_lines = (max_lines > 0) ? max_lines : 0;
+	max_bytes = (max_bytes > 0) ? max_bytes : 0;
+
+	/* lines read ahead by iteration come first */
+	PyObject* head = NULL;
+	if (pending(self) > 0) {
+		Py_ssize_t n = pending(self);
+		if (max_lines > 0 and max_lines < n) {
+			n = max_lines;
+		}
+		head = PyList_GetSlice(self->batch, self->next, self->next + n);
+		if (head == NULL) {
+			return NULL;
+		}
+		self->next += n;
+		Py_ssize_t bytes = 0;
+		for (Py_ssize_t i = 0; i < n; i++) {
+			bytes += PyString_GET_SIZE(PyList_GET_ITEM(head, i));
+		}
+		if ((max_lines > 0 and n == max_lines) or (max_bytes > 0 and bytes >= max_bytes)) {
+			return head;
+		}
+		max_lines = (max_lines > 0) ? max_lines - n : 0;
+		max_bytes = (max_bytes > 0) ? max_bytes - bytes : 0;
+	}
+
+	PyObject* lines = read_lines(f, max_lines, max_bytes);
+	if (head == NULL or lines == NULL) {
+		Py_XDECREF(head);
+		return lines;
+	}
+	PyObject* all = PySequence_InPlaceConcat(head, lines);
+	Py_DECREF(head);
+	Py_DECREF(lines);
+	return all;
+}
+
+/* lines are read ITER_BATCH_LINES at a time and handed out one by one */
+static PyObject* HDFSFile_iternext(HDFSFile* self) {
+	if (pending(self) == 0) {
+		HDFS_STREAM* f = opened(self);
+		if (f == NULL) {
+			return NULL;
+		}
+		drop_batch(self);
+		self->batch = read_lines(f, ITER_BATCH_LINES, ITER_BATCH_BYTES);
+		if (self->batch == NULL or PyList_GET_SIZE(self->batch) == 0) {
+			drop_batch(self);
+			return NULL;
+		}
+	}
+	PyObject* line = PyList_GET_ITEM(self->batch, self->next++);
+	Py_INCREF(line);
+	return line;
+}
+
+static PyObject* HDFSFile_pread(HDFSFile* self, PyObject* args) {
+	PY_LONG_LONG pos = 0;
+	Py_ssize_t size = 0;
+	if (PyArg_ParseTuple(args, "Ln", &pos, &size) == 0) {
+		return NULL;
+	}
+	HDFS_STREAM* f = opened(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	if (size < 0 or pos < 0) {
+		PyErr_SetString(PyExc_ValueError, "position and size must not be negative");
+		return NULL;
+	}
+
+	PyObject* str = PyString_FromStringAndSize(NULL, size);
+	if (str == NULL or size == 0) {
+		return str;
+	}
+	char* buf = PyString_AS_STRING(str);
+	Py_ssize_t total = 0;
+	tSize cnt = 0;
+	Py_BEGIN_ALLOW_THREADS
+	while (total < size and (cnt = f->pread(pos + total, buf + total, size - total)) > 0) {
+		total += cnt;
+	}
+	Py_END_ALLOW_THREADS
+	if (cnt < 0) {
+		Py_DECREF(str);
+		return io_error(self);
+	}
+	if (total < size) {
+		_PyString_Resize(&str, total);
+	}
+	return str;
+}
+
+/* a read-only memoryview of up to <size> bytes, mapped straight from a
+ * local block when short-circuit reads allow it, read the usual way
+ * otherwise. zero_copy tells which it was. */
+static PyObject* HDFSFile_read_zero(HDFSFile* self, PyObject* args) {
+	Py_ssize_t size = 0;
+	if (PyArg_ParseTuple(args, "n", &size) == 0) {
+		return NULL;
+	}
+	HDFS_STREAM* f = opened(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	if (pending(self) > 0) {
+		PyErr_SetString(PyExc_ValueError, "Mixing iteration and read methods would lose data");
+		return NULL;
+	}
+	if (size <= 0 or size > INT_MAX) {
+		PyErr_SetString(PyExc_ValueError, "size must be positive and below 2GB");
+		return NULL;
+	}
+
+	struct hadoopRzBuffer* rz = NULL;
+	int err = 0;
+	Py_BEGIN_ALLOW_THREADS
+	rz = f->read_zero(static_cast<int32_t>(size));
+	err = errno;
+	Py_END_ALLOW_THREADS
+
+	if (rz != NULL and hadoopRzBufferGet(rz) == NULL) { /* end of file */
+		Py_BEGIN_ALLOW_THREADS
+		f->release_zero(rz);
+		Py_END_ALLOW_THREADS
+		PyObject* empty = PyString_FromString("");
+		PyObject* view = PyMemoryView_FromObject(empty);
+		Py_XDECREF(empty);
+		return view;
+	}
+	if (rz != NULL) {
+		self->zero_copy = 1;
+		ZeroCopyBuffer* buf = PyObject_New(ZeroCopyBuffer, &ZeroCopyBufferType);
+		if (buf == NULL) {
+			Py_BEGIN_ALLOW_THREADS
+			f->release_zero(rz);
+			Py_END_ALLOW_THREADS
+			return NULL;
+		}
+		Py_INCREF(self);
+		buf->file = self;
+		buf->rz = rz;
+		PyObject* view = PyMemoryView_FromObject(reinterpret_cast<PyObject*>(buf));
+		Py_DECREF(buf);
+		return view;
+	}
+	if (err != EOPNOTSUPP) {
+		errno = err;
+		return io_error(self);
+	}
+
+	self->zero_copy = 0;
+	PyObject* str = PyString_FromStringAndSize(NULL, size);
+	if (str == NULL) {
+		return NULL;
+	}
+	ssize_t cnt = 0;
+	Py_BEGIN_ALLOW_THREADS
+	cnt = f->read_fully(PyString_AS_STRING(str), size);
+	err = errno;
+	Py_END_ALLOW_THREADS
+	if (cnt < 0) {  /* an error, not an empty buffer that would look like the end of file */
+		Py_DECREF(str);
+		errno = err;
+		return io_error(self);
+	}
+	_PyString_Resize(&str, cnt);
+	if (str == NULL) {
+		return NULL;
+	}
+	PyObject* view = PyMemoryView_FromObject(str);
+	Py_DECREF(str);
+	return view;
+}
+
+static PyObject* HDFSFile_write(HDFSFile* self, PyObject* args) {
+	const char* buf = NULL;
+	Py_ssize_t size = 0;
+	if (PyArg_ParseTuple(args, "s#", &buf, &size) == 0) {
+		return NULL;
+	}
+	HDFS_STREAM* f = opened_for_write(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	size_t nwrite = 0;
+	Py_BEGIN_ALLOW_THREADS
+	nwrite = f->write(buf, size);
+	Py_END_ALLOW_THREADS
+	if (nwrite != static_cast<size_t>(size)) {
+		return io_error(self);
+	}
+	return Py_BuildValue("n", nwrite);
+}
+
+/* write() for any buffer-protocol object, bytearray and memoryview included */
+static PyObject* HDFSFile_write_bytes(HDFSFile* self, PyObject* args) {
+	Py_buffer data;
+	if (PyArg_ParseTuple(args, "s*", &data) == 0) {
+		return NULL;
+	}
+	HDFS_STREAM* f = opened_for_write(self);
+	if (f == NULL) {
+		PyBuffer_Release(&data);
+		return NULL;
+	}
+	size_t nwrite = 0;
+	Py_BEGIN_ALLOW_THREADS
+	nwrite = f->write(data.buf, data.len);
+	Py_END_ALLOW_THREADS
+	Py_ssize_t size = data.len;
+	PyBuffer_Release(&data);
+	if (nwrite != static_cast<size_t>(size)) {
+		return io_error(self);
+	}
+	return Py_BuildValue("n", size);
+}
+
+static PyObject* HDFSFile_writelines(HDFSFile* self, PyObject* args) {
+	PyObject* lines = NULL;
+	if (PyArg_ParseTuple(args, "O", &lines) == 0) {
+		return NULL;
+	}
+	HDFS_STREAM* f = opened_for_write(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	return write_lines(f, lines, self->path);
+}
+
+static PyObject* HDFSFile_seek(HDFSFile* self, PyObject* args) {
+	PY_LONG_LONG pos = 0;
+	if (PyArg_ParseTuple(args, "L", &pos) == 0) {
+		return NULL;
+	}
+	HDFS_STREAM* f = opened(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	drop_batch(self);
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = f->seek(pos);
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		return io_error(self);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* HDFSFile_tell(HDFSFile* self, PyObject* args) {
+	HDFS_STREAM* f = opened(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	tOffset pos = 0;
+	Py_BEGIN_ALLOW_THREADS
+	pos = f->tell();
+	Py_END_ALLOW_THREADS
+	if (pos < 0) {
+		return io_error(self);
+	}
+	for (Py_ssize_t i = self->next; self->batch != NULL and i < PyList_GET_SIZE(self->batch); i++) {
+		pos -= PyString_GET_SIZE(PyList_GET_ITEM(self->batch, i));
+	}
+	return PyLong_FromLongLong(pos);
+}
+
+static PyObject* HDFSFile_flush(HDFSFile* self, PyObject* args) {
+	HDFS_STREAM* f = opened(self);
+	if (f == NULL) {
+		return NULL;
+	}
+	if (not f->writable()) {
+		Py_RETURN_NONE;
+	}
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = f->flush();
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		return io_error(self);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* HDFSFile_close(HDFSFile* self, PyObject* args) {
+	if (busy(self)) {
+		return NULL;
+	}
+	drop_batch(self);
+	HDFS_STREAM* f = self->f;
+	if (f == NULL or not f->is_open()) {
+		Py_RETURN_NONE;
+	}
+	int ret = 0;
+	Py_BEGIN_ALLOW_THREADS
+	ret = f->close();
+	Py_END_ALLOW_THREADS
+	if (ret != 0) {
+		return io_error(self);
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject* HDFSFile_enter(HDFSFile* self, PyObject* args) {
+	if (opened(self) == NULL) {
+		return NULL;
+	}
+	Py_INCREF(self);
+	return reinterpret_cast<PyObject*>(self);
+}
+
+static PyObject* HDFSFile_exit(HDFSFile* self, PyObject* args) {
+	PyObject* ret = HDFSFile_close(self, NULL);
+	if (ret == NULL) {
+		return NULL;
+	}
+	Py_DECREF(ret);
+	return Py_BuildValue("O", Py_False);
+}
+
+static PyObject* HDFSFile_zero_copy(HDFSFile* self, void* closure) {
+	if (self->zero_copy < 0) {
+		Py_RETURN_NONE;
+	}
+	return PyBool_FromLong(self->zero_copy);
+}
+
+static PyObject* HDFSFile_closed(HDFSFile* self, void* closure) {
+	return PyBool_FromLong(self->f == NULL or not self->f->is_open());
+}
+
+static PyMethodDef HDFSFileMethods[] = {
+	{"read",       (PyCFunction)HDFSFile_read,     METH_VARARGS, "read([size])              at most <size> bytes, the rest of the file without <size>"},
+	{"readline",   (PyCFunction)HDFSFile_readline, METH_NOARGS,  "readline()                next line including '\\n', '' at the end of file"},
+	{"readlines",  (PyCFunction)HDFSFile_readlines, METH_VARARGS, "readlines([lines[, bytes]]) list of the next <lines> lines or about <bytes> bytes, 0 means all"},
+	{"read_bytes", (PyCFunction)HDFSFile_read_bytes, METH_VARARGS, "read_bytes(size)          <size> bytes as they are, fewer only at the end of file, '' there"},
+	{"readinto",   (PyCFunction)HDFSFile_readinto, METH_VARARGS, "readinto(buffer)          fill a writable buffer such as a bytearray, number of bytes read returned"},
+	{"pread",      (PyCFunction)HDFSFile_pread,    METH_VARARGS, "pread(pos, size)          <size> bytes from offset <pos>, the file offset does not move"},
+	{"read_zero",  (PyCFunction)HDFSFile_read_zero, METH_VARARGS, "read_zero(size)           memoryview of at most <size> bytes, mmapped from local blocks when possible"},
+	{"write",      (PyCFunction)HDFSFile_write,    METH_VARARGS, "write(data)               write <data>, number of bytes returned"},
+	{"write_bytes", (PyCFunction)HDFSFile_write_bytes, METH_VARARGS, "write_bytes(buffer)       write any buffer object with its length, NUL bytes included, number of bytes returned"},
+	{"writelines", (PyCFunction)HDFSFile_writelines, METH_VARARGS, "writelines(iterable)      write every string or buffer of <iterable>, number of bytes returned"},
+	{"seek",       (PyCFunction)HDFSFile_seek,     METH_VARARGS, "seek(pos)                 move to absolute offset <pos>, read mode only"},
+	{"tell",       (PyCFunction)HDFSFile_tell,     METH_NOARGS,  "tell()                    current offset"},
+	{"flush",      (PyCFunction)HDFSFile_flush,    METH_NOARGS,  "flush()                   write out combined writes and flush them to the datanodes"},
+	{"close",      (PyCFunction)HDFSFile_close,    METH_NOARGS,  "close()                   close the file, calling it twice is fine"},
+	{"__enter__",  (PyCFunction)HDFSFile_enter,    METH_NOARGS,  NULL},
+	{"__exit__",   (PyCFunction)HDFSFile_exit,     METH_VARARGS, NULL},
+	{NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef HDFSFileGetSet[] = {
+	{(char*)"closed", (getter)HDFSFile_closed, NULL, (char*)"True once close() has been called", NULL},
+	{(char*)"zero_copy", (getter)HDFSFile_zero_copy, NULL, (char*)"whether the last read_zero() was zero-copy, None before the first one", NULL},
+	{NULL, NULL, NULL, NULL, NULL},
+};
+
+static PyTypeObject HDFSFileType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"awesome_hdfs.HDFSFile",                  /* tp_name */
+	sizeof(HDFSFile),                         /* tp_basicsize */
+	0,                                        /* tp_itemsize */
+	(destructor)HDFSFile_dealloc,             /* tp_dealloc */
+	0,                                        /* tp_print */
+	0,                                        /* tp_getattr */
+	0,                                        /* tp_setattr */
+	0,                                        /* tp_compare */
+	0,                                        /* tp_repr */
+	0,                                        /* tp_as_number */
+	0,                                        /* tp_as_sequence */
+	0,                                        /* tp_as_mapping */
+	0,                                        /* tp_hash */
+	0,                                        /* tp_call */
+	0,                                        /* tp_str */
+	0,                                        /* tp_getattro */
+	0,                                        /* tp_setattro */
+	0,                                        /* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_ITER, /* tp_flags */
+	"HDFSFile(path, mode='r')  an hdfs file, mode should be 'r', 'w' or 'a'", /* tp_doc */
+	0,                                        /* tp_traverse */
+	0,                                        /* tp_clear */
+	0,                                        /* tp_richcompare */
+	0,                                        /* tp_weaklistoffset */
+	PyObject_SelfIter,                        /* tp_iter */
+	(iternextfunc)HDFSFile_iternext,          /* tp_iternext */
+	HDFSFileMethods,                          /* tp_methods */
+	0,                                        /* tp_members */
+	HDFSFileGetSet,                           /* tp_getset */
+	0,                                        /* tp_base */
+	0,                                        /* tp_dict */
+	0,                                        /* tp_descr_get */
+	0,                                        /* tp_descr_set */
+	0,                                        /* tp_dictoffset */
+	(initproc)HDFSFile_init,                  /* tp_init */
+	0,                                        /* tp_alloc */
+	PyType_GenericNew,                        /* tp_new */
+};
+
+
+static PyMethodDef ExtestMethods[] = {
+	{"ls",         ls,         METH_VARARGS, "ls(path)                  list contents of <path>, python-list returned"},
+	{"mv",         mv,         METH_VARARGS, "mv(old, new)              move path from <old> to <new>, 0/errorno returned"},
+	{"rm",         rm,         METH_VARARGS, "rm(path)                  rm -r <path>, 0/errorno returned"},
+	{"put",        put,        METH_VARARGS, "put(local, remote)        upload file to hdfs, 0/errorno returned"},
+	{"putf",       putf,       METH_VARARGS, "putf(local, remote)       force upload file to hdfs, 0/errorno returned"},
+	{"put_many",   put_many,   METH_VARARGS, "put_many(srcs, dir[, writers[, progress]]) upload local files into dir concurrently, 0/errorno per file returned"},
+	{"put_tree",   put_tree,   METH_VARARGS, "put_tree(local, dir[, writers[, progress]]) upload a local directory tree, {local path: 0/errorno} returned"},
+	{"mkdir",      mkdir,      METH_VARARGS, "mkdir(path)               mkdir of path, 0/errorno returned"},
+	{"chmod",      chmod,      METH_VARARGS, "chmod(path, mode)         mode must be int like 655,644, 0/errorno returned"},
+	{"chown",      chown,      METH_VARARGS, "chown(path, owner, group) all parameters should be string, 0/errorno returned"},
+	{"rm_many",    rm_many,    METH_VARARGS, "rm_many(paths[, in_flight]) rm of every path or glob match, <in_flight> at a time, refuses /, {path: 0/errorno} returned"},
+	{"chmod_many", chmod_many, METH_VARARGS, "chmod_many(paths, mode[, in_flight]) chmod of every path or glob match, {path: 0/errorno} returned"},
+	{"chown_many", chown_many, METH_VARARGS, "chown_many(paths, owner, group[, in_flight]) chown of every path or glob match, None leaves owner or group as is, {path: 0/errorno} returned"},
+	{"set_replication", set_replication, METH_VARARGS, "set_replication(paths, n[, in_flight]) replication of every file or glob match, {path: 0/errorno} returned"},
+	{"utime",      utime,      METH_VARARGS, "utime(paths, mtime, atime[, in_flight]) times in ms of every path or glob match, -1 for no change, {path: 0/errorno} returned"},
+	{"exist",      exist,      METH_VARARGS, "exist(path)               whether <path> exists, True/False returned"},
+	{"exist_many", exist_many, METH_VARARGS, "exist_many(paths)         exist() of every path in one batch, python-list of True/False returned in order"},
+	{"glob",       glob,       METH_VARARGS, "glob(pattern)             every path matching <pattern>, supports * ? [] {a,b} and **, python-list returned"},
+	{"set_parallelism", set_parallelism, METH_VARARGS, "set_parallelism(n)        number of connections glob() lists directories with, 0 returned"},
+	{"open",       open,       METH_VARARGS, "open(path, mode)          mode should be 'r' or 'w', 0/errorno returned, remeber to call close() at the end"},
+	{"close",      close,      METH_VARARGS, "close()                   close hdfsFile which is opened by the last open(path, mode) call"},
 	{"writeline",  writeline,  METH_VARARGS, "writeline(line)           line should contains '\\r\\n' or '\\n', ex: writeline('something\\n')"},
+	{"write_bytes", write_bytes, METH_VARARGS, "write_bytes(buffer)       write any buffer object to the open()ed file with its length, number of bytes returned"},
+	{"read_bytes", read_bytes, METH_VARARGS, "read_bytes(size)          <size> bytes of the open()ed file, fewer only at its end, '' there"},
+	{"writelines", writelines, METH_VARARGS, "writelines(iterable)      write every string or buffer of <iterable> to the open()ed file, number of bytes returned"},
 	{"readline",   readline,   METH_VARARGS, "readline()                return a line from the file last opend by open(path, mode)"},
+	{"readlines",  readlines,  METH_VARARGS, "readlines([lines[, bytes]]) list of the next <lines> lines or about <bytes> bytes of the open()ed file"},
+	{"get",        get,        METH_VARARGS, "get(remote, local[, streams]) download a file one block per range, <streams> at once, 0/errorno returned"},
 	{"getmerge",   getmerge,   METH_VARARGS, "getmerge(remote, local)   merge hdfs file to local, 0/errorno returned"},
+	{"blocks",     blocks,     METH_VARARGS, "blocks(pattern)           (path, offset, length, hosts) of every block of the matching files, python-list returned"},
+	{"splits",     splits,     METH_VARARGS, "splits(pattern, workers[, split_size]) byte ranges of the matching files per worker host, local ones preferred, a list of (path, offset, length, local) per worker returned"},
+	{"du",         du,         METH_VARARGS, "du(path[, top[, histogram]]) bytes, replicated bytes, files, dirs under path, the <top> heaviest subdirectories and a log2 file size histogram, python-dict returned"},
+	{"count",      count,      METH_VARARGS, "count(path)               dirs, files and bytes under path like hadoop fs -count, python-dict returned"},
+	{"walk",       (PyCFunction)walk, METH_VARARGS | METH_KEYWORDS, "walk(path, name_glob=None, min_size=-1, max_size=-1, mtime_after=0, mtime_before=0, kind=None, max_depth=0, prune=False) iterator of (path, kind, size, mtime, replication, owner, group, permissions) under path, in no order"},
+	{"find",       (PyCFunction)find, METH_VARARGS | METH_KEYWORDS, "find(path, ...)           sorted paths under path, keywords as for walk()"},
 	{"dirinfo",    dirinfo,    METH_VARARGS, "dirinfo(path)             return the name, lastmodifytime of the path"},
+	{"warmup",     warmup,     METH_VARARGS, "warmup([wait])            start the JVM and connect in the background instead of on the first call, 0/errorno returned"},
+	{"set_pool_size", set_pool_size, METH_VARARGS, "set_pool_size(n)          max number of namenode connections shared by all threads, 0 returned"},
+	{"set_read_buffer", set_read_buffer, METH_VARARGS, "set_read_buffer(size[, readahead]) bytes sequential reads grow the buffer to (4MB), readahead thread on/off, 0 returned"},
+	{"set_write_buffer", set_write_buffer, METH_VARARGS, "set_write_buffer(size)    bytes small writes are combined up to before they are sent (1MB), 0 for none, 0 returned"},
+	{"set_put_buffers", set_put_buffers, METH_VARARGS, "set_put_buffers(size, depth) uploads read ahead into <depth> buffers of <size> bytes (8MB, 4), 0 returned"},
+	{"pool_stats", pool_stats, METH_VARARGS, "pool_stats()              leases/waits/reconnects of the connection pool, python-dict returned"},
+	{"cache_config", cache_config, METH_VARARGS, "cache_config(capacity, ttl) metadata cache size in entries and ttl in ms, capacity 0 disables it"},
+	{"cache_stats", cache_stats, METH_VARARGS, "cache_stats()             hits/misses/evictions of the metadata cache, python-dict returned"},
+	{"cache_clear", cache_clear, METH_VARARGS, "cache_clear()             drop everything the metadata cache holds"},
+	{"read_stats", read_stats, METH_VARARGS, "read_stats([per_path])    total/local/short-circuit/zero-copy/remote bytes of the files read so far, python-dict returned"},
+	{"read_stats_config", read_stats_config, METH_VARARGS, "read_stats_config(bytes)  log the read statistics of files that read at least <bytes> when closed, -1 for none"},
+	{"read_stats_clear", read_stats_clear, METH_VARARGS, "read_stats_clear()        start the read statistics over"},
+	{"metrics",    metrics,    METH_VARARGS, "metrics()                 count, errors, bytes and latency percentiles of every libhdfs call and method, python-dict returned"},
+	{"metrics_config", metrics_config, METH_VARARGS, "metrics_config(enabled)   turn the timing of calls on or off, on by default"},
+	{"metrics_clear", metrics_clear, METH_VARARGS, "metrics_clear()           start the metrics over"},
+	{"metrics_export", metrics_export, METH_VARARGS, "metrics_export(path, seconds) rewrite <path> in prometheus text format every <seconds>, 0 stops, 0/errorno returned"},
 	{NULL, NULL, 0, NULL},
 };
 
+/* every wrapper drops the GIL around its libhdfs work, so calls from several
+ * python threads run concurrently on pooled connections. */
 PyMODINIT_FUNC initawesome_hdfs() {
+	PyEval_InitThreads();
 	log_init("", LOG_CONSOLE);
-	Py_InitModule("awesome_hdfs", ExtestMethods);
-	hdfs.init(HOST, PORT);
+	PyObject* m = Py_InitModule("awesome_hdfs", ExtestMethods);
+	if (m == NULL or PyType_Ready(&HDFSFileType) < 0 or PyType_Ready(&ZeroCopyBufferType) < 0
+			or PyType_Ready(&WalkIterType) < 0) {
+		return;
+	}
+	PyObject* type = reinterpret_cast<PyObject*>(&HDFSFileType);
+	Py_INCREF(type);
+	PyModule_AddObject(m, "HDFSFile", type);
+	hdfs.init(HOST, PORT);  /* connects on first use, see warmup() */
 }
 
 
@@ -0,0 +1,140 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "read_stats.h"
+#include "log.h"
+
+#include <string.h>
+#include <errno.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+READ_STATS::READ_STATS() {
+	this->log_bytes = -1;
+	this->dropped = 0;
+	memset(&this->total, 0, sizeof(this->total));
+	pthread_mutex_init(&this->lock, NULL);
+}
+
+READ_STATS::~READ_STATS() {
+	pthread_mutex_destroy(&this->lock);
+}
+
+static void add(read_stats* to, const read_stats &st) {
+	to->files += st.files;
+	to->bytes += st.bytes;
+	to->local_bytes += st.local_bytes;
+	to->short_circuit_bytes += st.short_circuit_bytes;
+	to->zero_copy_bytes += st.zero_copy_bytes;
+	to->remote_bytes += st.remote_bytes;
+}
+
+/* <f> must still be open. files open for writing have nothing to report */
+void READ_STATS::capture(const char* path, hdfsFile f, bool count_file) {
+	if (f == NULL or hdfsFileIsOpenForRead(f) != 1) {
+		return;
+	}
+	struct hdfsReadStatistics* s = NULL;
+	int err = errno;
+	if (hdfsFileGetReadStatistics(f, &s) != 0) {
+		errno = err;
+		return;
+	}
+	read_stats st;
+	st.files = count_file ? 1 : 0;
+	st.bytes = s->totalBytesRead;
+	st.local_bytes = s->totalLocalBytesRead;
+	st.short_circuit_bytes = s->totalShortCircuitBytesRead;
+	st.zero_copy_bytes = s->totalZeroCopyBytesRead;
+	st.remote_bytes = hdfsReadStatisticsGetRemoteBytesRead(s);
+	hdfsFileFreeReadStatistics(s);
+	errno = err;
+
+	const char* key = strstr(path, "://");
+	key = (key == NULL) ? path : strchr(key + 3, '/');
+	if (key == NULL) {
+		key = "/";
+	}
+
+	pthread_mutex_lock(&this->lock);
+	add(&this->total, st);
+	std::map<std::string, read_stats>::iterator it = this->by_path.find(key);
+	if (it != this->by_path.end()) {
+		add(&it->second, st);
+	} else if (this->by_path.size() < READ_STATS_MAX_PATHS) {
+		this->by_path[key] = st;
+	} else {
+		this->dropped++;
+	}
+	bool report = (this->log_bytes >= 0 and st.bytes >= static_cast<uint64_t>(this->log_bytes));
+	pthread_mutex_unlock(&this->lock);
+
+	if (report) {
+		info("read %s: %llu bytes, %llu local, %llu short-circuit, %llu zero-copy, %llu remote\n", key,
+			(unsigned long long)st.bytes, (unsigned long long)st.local_bytes,
+			(unsigned long long)st.short_circuit_bytes, (unsigned long long)st.zero_copy_bytes,
+			(unsigned long long)st.remote_bytes);
+	}
+}
+
+/* files that read <log_bytes> or more are logged when closed, -1 for none */
+void READ_STATS::configure(int64_t log_bytes) {
+	pthread_mutex_lock(&this->lock);
+	this->log_bytes = log_bytes;
+	pthread_mutex_unlock(&this->lock);
+}
+
+void READ_STATS::totals(read_stats* st) {
+	pthread_mutex_lock(&this->lock);
+	*st = this->total;
+	pthread_mutex_unlock(&this->lock);
+}
+
+void READ_STATS::paths(std::map<std::string, read_stats> &out) {
+	pthread_mutex_lock(&this->lock);
+	out = this->by_path;
+	pthread_mutex_unlock(&this->lock);
+}
+
+/* files read after READ_STATS_MAX_PATHS paths were already tracked */
+uint64_t READ_STATS::untracked() {
+	pthread_mutex_lock(&this->lock);
+	uint64_t n = this->dropped;
+	pthread_mutex_unlock(&this->lock);
+	return n;
+}
+
+void READ_STATS::clear() {
+	pthread_mutex_lock(&this->lock);
+	memset(&this->total, 0, sizeof(this->total));
+	this->by_path.clear();
+	this->dropped = 0;
+	pthread_mutex_unlock(&this->lock);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,80 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DANGDANG_READ_STATS
+#define DANGDANG_READ_STATS
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <map>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hdfs.h"
+
+#define READ_STATS_MAX_PATHS 10000  /* paths tracked one by one, later ones only count in the totals */
+
+struct read_stats {
+	uint64_t files;
+	uint64_t bytes;
+	uint64_t local_bytes;
+	uint64_t short_circuit_bytes;
+	uint64_t zero_copy_bytes;
+	uint64_t remote_bytes;
+};
+
+/* what hdfsFileGetReadStatistics reports for every file read, captured right
+ * before it is closed, summed for the process and per path. a file read
+ * through several handles, by ranges, counts once: only one of its captures
+ * has <count_file> set. the paths are
+ * keyed without "hdfs://host:port" like in META_CACHE. */
+class READ_STATS {
+	public:
+		READ_STATS();
+		~READ_STATS();
+
+		void capture(const char* path, hdfsFile f, bool count_file);
+		void configure(int64_t log_bytes);
+		void totals(read_stats* st);
+		void paths(std::map<std::string, read_stats> &out);
+		uint64_t untracked();
+		void clear();
+	private:
+		int64_t log_bytes;  /* files that read at least this much are logged, -1 for none */
+		read_stats total;
+		std::map<std::string, read_stats> by_path;
+		uint64_t dropped;   /* files whose path did not fit in <by_path> */
+		pthread_mutex_t lock;
+};
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif
@@ -0,0 +1,198 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "task_queue.h"
+#include "log.h"
+
+#include <string.h>
+#include <errno.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the worker the calling thread is, for pushes made by a running task */
+static __thread TASK_QUEUE* current_queue = NULL;
+static __thread size_t current_worker = 0;
+
+TASK_QUEUE::TASK_QUEUE(std::vector<hdfsFS> &conns) : deques(conns.size()) {
+	check(conns.size() > 0);
+	this->conns = conns;
+	for (size_t i = 0; i < this->deques.size(); i++) {
+		pthread_mutex_init(&this->deques[i].lock, NULL);
+	}
+	this->queued = 0;
+	this->pending = 0;
+	this->idle = 0;
+	this->stolen = 0;
+	this->next = 0;
+	this->halted = false;
+	pthread_mutex_init(&this->lock, NULL);
+	pthread_cond_init(&this->cond, NULL);
+}
+
+TASK_QUEUE::~TASK_QUEUE() {
+	check(this->pending == 0);
+	for (size_t i = 0; i < this->deques.size(); i++) {
+		pthread_mutex_destroy(&this->deques[i].lock);
+	}
+	pthread_cond_destroy(&this->cond);
+	pthread_mutex_destroy(&this->lock);
+}
+
+void TASK_QUEUE::push(task_fn fn, void* arg) {
+	task t;
+	t.fn = fn;
+	t.arg = arg;
+
+	size_t index = 0;
+	if (current_queue == this) {
+		index = current_worker;
+	} else {
+		index = __sync_fetch_and_add(&this->next, 1) % this->deques.size();
+	}
+	__sync_fetch_and_add(&this->pending, 1);
+	deque &d = this->deques[index];
+	pthread_mutex_lock(&d.lock);
+	d.tasks.push_back(t);
+	pthread_mutex_unlock(&d.lock);
+	__sync_fetch_and_add(&this->queued, 1);
+
+	/* an idle worker raises <idle> before its last look at <queued> */
+	if (__sync_fetch_and_add(&this->idle, 0) > 0) {
+		pthread_mutex_lock(&this->lock);
+		pthread_cond_signal(&this->cond);
+		pthread_mutex_unlock(&this->lock);
+	}
+}
+
+/* tasks still run after stop(), they are expected to check stopped() and
+ * release their arguments without doing any more rpc. */
+void TASK_QUEUE::stop() {
+	this->halted = true;
+}
+
+bool TASK_QUEUE::stopped() {
+	return this->halted;
+}
+
+unsigned long TASK_QUEUE::steals() {
+	return this->stolen;
+}
+
+void* TASK_QUEUE::worker(void* arg) {
+	worker_arg* w = reinterpret_cast<worker_arg*>(arg);
+	w->queue->work(w->index);
+	return NULL;
+}
+
+/* the newest task of our own deque, else the oldest one of somebody else's */
+bool TASK_QUEUE::take(size_t index, task &t) {
+	size_t n = this->deques.size();
+	for (size_t i = 0; i < n; i++) {
+		deque &d = this->deques[(index + i) % n];
+		pthread_mutex_lock(&d.lock);
+		if (not d.tasks.empty()) {
+			if (i == 0) {
+				t = d.tasks.back();
+				d.tasks.pop_back();
+			} else {
+				t = d.tasks.front();
+				d.tasks.pop_front();
+				__sync_fetch_and_add(&this->stolen, 1);
+			}
+			pthread_mutex_unlock(&d.lock);
+			__sync_fetch_and_sub(&this->queued, 1);
+			return true;
+		}
+		pthread_mutex_unlock(&d.lock);
+	}
+	return false;
+}
+
+void TASK_QUEUE::work(size_t index) {
+	TASK_QUEUE* outer_queue = current_queue;
+	size_t outer_worker = current_worker;
+	current_queue = this;
+	current_worker = index;
+	hdfsFS fs = this->conns[index];
+
+	while (true) {
+		task t;
+		if (this->take(index, t)) {
+			t.fn(this, fs, t.arg);
+			if (__sync_sub_and_fetch(&this->pending, 1) == 0) {
+				pthread_mutex_lock(&this->lock);
+				pthread_cond_broadcast(&this->cond);
+				pthread_mutex_unlock(&this->lock);
+			}
+			continue;
+		}
+
+		pthread_mutex_lock(&this->lock);
+		__sync_fetch_and_add(&this->idle, 1);
+		while (__sync_fetch_and_add(&this->queued, 0) == 0 and __sync_fetch_and_add(&this->pending, 0) > 0) {
+			pthread_cond_wait(&this->cond, &this->lock);
+		}
+		__sync_fetch_and_sub(&this->idle, 1);
+		bool finished = (__sync_fetch_and_add(&this->pending, 0) == 0);  /* nothing queued and nobody left to queue more */
+		pthread_mutex_unlock(&this->lock);
+		if (finished) {
+			break;
+		}
+	}
+
+	current_queue = outer_queue;
+	current_worker = outer_worker;
+}
+
+/* blocks until every task, including those pushed by other tasks, is done.
+ * the calling thread works with conns[0], so a single connection never
+ * spawns a thread at all. */
+void TASK_QUEUE::run() {
+	size_t n = this->conns.size();
+	std::vector<pthread_t> threads;
+	std::vector<worker_arg> args(n);
+	for (size_t i = 1; i < n; i++) {
+		args[i].queue = this;
+		args[i].index = i;
+		pthread_t tid;
+		int err = pthread_create(&tid, NULL, TASK_QUEUE::worker, &args[i]);
+		if (err != 0) {
+			error("pthread_create:%s\n", strerror(err));
+			break;
+		}
+		threads.push_back(tid);
+	}
+
+	this->work(0);
+
+	for (size_t i = 0; i < threads.size(); i++) {
+		pthread_join(threads[i], NULL);
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,94 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) [2015] [liangchengming]
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef DANGDANG_TASK_QUEUE
+#define DANGDANG_TASK_QUEUE
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "hdfs.h"
+
+class TASK_QUEUE;
+
+/* a task runs on one of the worker threads with that worker's own connection,
+ * and may push more tasks into the queue it is running on. */
+typedef void (*task_fn)(TASK_QUEUE* queue, hdfsFS fs, void* arg);
+
+/* every worker owns a deque. tasks pushed by a task go to the back of its
+ * worker's deque and are taken from there again, so a tree walk goes
+ * depth first on each worker; an idle worker steals from the front of the
+ * others, where the biggest untouched subtrees wait. */
+class TASK_QUEUE {
+	public:
+		TASK_QUEUE(std::vector<hdfsFS> &conns);
+		~TASK_QUEUE();
+
+		void push(task_fn fn, void* arg);
+		void run();
+		void stop();
+		bool stopped();
+		unsigned long steals();
+	private:
+		struct task {
+			task_fn fn;
+			void* arg;
+		};
+		struct deque {
+			std::deque<task> tasks;
+			pthread_mutex_t lock;
+		};
+		struct worker_arg {
+			TASK_QUEUE* queue;
+			size_t index;
+		};
+		static void* worker(void* arg);
+		void work(size_t index);
+		bool take(size_t index, task &t);
+
+		std::vector<hdfsFS> conns;
+		std::vector<deque> deques;
+		volatile long queued;   /* in the deques */
+		volatile long pending;  /* queued or running */
+		volatile int idle;
+		volatile unsigned long stolen;
+		volatile size_t next;   /* where pushes from outside the workers go */
+		volatile bool halted;
+
+		pthread_mutex_t lock;   /* only for idle workers to sleep on */
+		pthread_cond_t cond;
+};
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif